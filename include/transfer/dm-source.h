@@ -48,6 +48,16 @@ public:
     void open_app(const Transfer::Id& id) override;
     const std::shared_ptr<const MutableModel> get_model() override;
 
+    // how long transfers' progress, speed, and ETA changes are coalesced
+    // before being emitted. State changes are always emitted promptly.
+    void set_change_interval(unsigned int interval_msec);
+
+    // limits on the finished, canceled, and failed transfers that are kept.
+    // older ones disappear from the indicator as if they'd been cleared.
+    // by default there are no limits, unless INDICATOR_TRANSFER_PRUNE_RETIRED
+    // is set: then up to 50 are kept for up to a week, within a 4 MiB budget.
+    void set_retention_policy(const MutableModel::RetentionPolicy& policy);
+
 private:
     class Impl;
     std::unique_ptr<Impl> impl;
@@ -24,8 +24,19 @@
 
 #include <core/signal.h>
 
+#include <glib.h> // GMainContext, GSource
+
+#include <algorithm> // std::max()
+#include <array>
+#include <atomic>
+#include <cstdint> // uint32_t, uint64_t
+#include <deque>
 #include <map>
 #include <memory> // std::shared_ptr
+#include <mutex>
+#include <set>
+#include <thread> // std::thread::id
+#include <vector>
 
 namespace unity {
 namespace indicator {
@@ -37,6 +48,20 @@ namespace transfer {
 class Model
 {
 public:
+    /**
+     * A small integer that identifies a Transfer in this model.
+     * It stays valid for as long as the Transfer is in the model;
+     * after the Transfer is removed, it may be reused for another one.
+     */
+    typedef uint32_t Handle;
+    static constexpr Handle INVALID_HANDLE {UINT32_MAX};
+
+    /**
+     * A counter that goes up each time a transfer is added, changed, or removed.
+     * Zero means "before anything happened".
+     */
+    typedef uint64_t Generation;
+
     virtual ~Model();
 
     std::set<Transfer::Id> get_ids() const;
@@ -45,15 +70,331 @@ public:
     int size() const;
     int count(const Transfer::Id&) const;
 
+    Handle get_handle(const Transfer::Id&) const;
+    std::shared_ptr<Transfer> get_by_handle(Handle) const;
+
+    /**
+     * The model's current generation, and the generation
+     * in which a transfer was last added or changed (0 if it's not here).
+     */
+    Generation generation() const;
+    Generation get_generation(const Transfer::Id&) const;
+
+    /**
+     * Counts and sums over all the transfers in the model.
+     * They're updated as transfers are added, changed, and removed,
+     * so reading them is O(1). They reflect each transfer as it was
+     * when it was last added or passed to MutableModel::emit_changed().
+     */
+    struct Totals
+    {
+        std::array<int,Transfer::ERROR+1> n_in_state {};
+        uint64_t total_size = 0;
+        uint64_t received = 0;   // bytes
+        uint64_t speed_Bps = 0;
+        uint64_t remaining = 0;  // bytes left in unfinished transfers
+
+        // how many transfers in each state answer yes to can_pause(),
+        // can_resume() and can_clear(). sources can override those,
+        // so they're asked rather than inferred from the state.
+        std::array<int,Transfer::ERROR+1> n_can_pause {};
+        std::array<int,Transfer::ERROR+1> n_can_resume {};
+        std::array<int,Transfer::ERROR+1> n_can_clear {};
+
+        // the overall ETA, or -1 if unknown
+        int seconds_left() const;
+    };
+    const Totals& get_totals() const;
+
+    /**
+     * The transfers' hot numeric fields, in parallel arrays indexed by Handle.
+     * Like the Totals, they reflect each transfer as of its last add or
+     * emit_changed(). Scanning them touches a few bytes per transfer instead
+     * of a whole Transfer. Free slots have state FREE_SLOT and zeroes
+     * elsewhere, so loops over the columns don't need to branch on them.
+     */
+    struct Columns
+    {
+        static constexpr uint8_t FREE_SLOT {31}; // never set in a StateMask
+        std::vector<uint8_t> state;
+        std::vector<float> progress;
+        std::vector<int32_t> seconds_left;
+        std::vector<uint64_t> speed_Bps;
+        std::vector<uint64_t> total_size;
+    };
+    const Columns& get_columns() const;
+
+    /**
+     * Kernels that scan the columns, for queries the Totals don't answer.
+     */
+    typedef uint32_t StateMask;
+    static constexpr StateMask state_bit(Transfer::State state) {return StateMask(1) << state;}
+    int count_in_states(StateMask) const;
+    bool any_in_states(StateMask) const;
+    std::array<int,Transfer::ERROR+1> count_by_state() const;
+    uint64_t sum_speed() const;
+
+    /**
+     * Calls visit(Transfer&) for each transfer in the model,
+     * without copying the ids or the shared_ptrs as get_ids() and get_all() do.
+     *
+     * The visitor may add and remove transfers. Transfers added during
+     * the walk are not visited. Transfers removed before they are reached
+     * are skipped. Removed transfers are kept alive until the walk ends,
+     * so it is safe for the visitor to remove the transfer it is visiting.
+     */
+    template<typename Visitor>
+    void for_each(Visitor visit) const
+    {
+        WalkGuard guard(*this);
+
+        // m_slots may grow during the walk, so index it rather than iterating
+        for (size_t i=0, n=m_slots.size(); i<n; ++i)
+          {
+            auto transfer = m_slots[i].transfer.get();
+            if (transfer != nullptr)
+              visit(*transfer);
+          }
+    }
+
     const core::Signal<Transfer::Id>& changed() const;
     const core::Signal<Transfer::Id>& added() const;
     const core::Signal<Transfer::Id>& removed() const;
 
+    /**
+     * The deduplicated ids that were added, changed, or removed in a batch.
+     * Changed ids are mapped to the Transfer::Fields that changed,
+     * so that listeners can skip work whose inputs are unchanged.
+     *
+     * An id is never in both added and changed. If a transfer was removed
+     * and then a new one added with the same id, the id is in both removed
+     * and added, so consumers should handle removed, then added, then changed.
+     */
+    struct Changes
+    {
+        std::set<Transfer::Id> added;
+        std::map<Transfer::Id,Transfer::Fields> changed;
+        std::set<Transfer::Id> removed;
+        bool empty() const;
+    };
+
+    /**
+     * Emitted after added(), changed() and removed() with everything that
+     * happened in a MutableModel batch, or right after each of them for
+     * changes made outside of a batch. Listeners that only connect to this
+     * signal see every change.
+     */
+    const core::Signal<Changes>& batch() const;
+
+    /**
+     * Sets 'setme' to what was added, changed, or removed since the
+     * given generation, with the same semantics as a batch().
+     * This lets a consumer that fell behind catch up without a rebuild.
+     * The model doesn't remember which fields changed, so changed ids
+     * are mapped to Transfer::ALL_FIELDS.
+     *
+     * Returns false if the model no longer remembers all the removals
+     * since that generation. The caller should then rebuild from scratch.
+     */
+    bool changes_since(Generation since, Changes& setme) const;
+
+    /**
+     * An immutable view of all the transfers as of a generation.
+     *
+     * It holds copies of the transfers' Transfer fields, taken when the
+     * snapshot was published, so it's safe to read from any thread and
+     * never changes underfoot. The copies are plain Transfers: a source's
+     * subclass, and its overrides of virtuals like can_resume() and
+     * memory_usage(), don't come along. Ask the model itself, on its own
+     * thread, when those answers matter.
+     */
+    class Snapshot
+    {
+    public:
+        Generation generation() const {return m_generation;}
+        int size() const {return m_size;}
+        const Totals& get_totals() const {return m_totals;}
+
+        std::shared_ptr<const Transfer> get(const Transfer::Id&) const;
+        std::vector<std::shared_ptr<const Transfer>> get_all() const;
+
+        template<typename Visitor>
+        void for_each(Visitor visit) const
+        {
+            for (const auto& page : m_pages)
+                for (const auto& chunk : *page)
+                    for (const auto& transfer : *chunk)
+                        if (transfer)
+                            visit(*transfer);
+        }
+
+        /**
+         * Calls visit(const Transfer* before, const Transfer* after) for
+         * each handle whose transfer differs from the one in 'older'.
+         * Either pointer is nullptr if that snapshot's slot is empty, and
+         * if both are set their ids may differ because handles are reused.
+         * Subtrees that the two snapshots share are skipped, so this costs
+         * about as much as the changes between them.
+         */
+        template<typename Visitor>
+        void diff(const Snapshot& older, Visitor visit) const
+        {
+            static const Chunk empty_chunk {};
+            static const Page empty_page {};
+
+            const auto n_pages = std::max(m_pages.size(), older.m_pages.size());
+            for (size_t p=0; p<n_pages; ++p)
+              {
+                const auto& a = p<older.m_pages.size() ? older.m_pages[p] : nullptr;
+                const auto& b = p<m_pages.size() ? m_pages[p] : nullptr;
+                if (a == b)
+                    continue;
+                const auto& apage = a ? *a : empty_page;
+                const auto& bpage = b ? *b : empty_page;
+                for (size_t c=0; c<FANOUT; ++c)
+                  {
+                    if (apage[c] == bpage[c])
+                        continue;
+                    const auto& achunk = apage[c] ? *apage[c] : empty_chunk;
+                    const auto& bchunk = bpage[c] ? *bpage[c] : empty_chunk;
+                    for (size_t i=0; i<FANOUT; ++i)
+                        if (achunk[i] != bchunk[i])
+                            visit(achunk[i].get(), bchunk[i].get());
+                  }
+              }
+        }
+
+    private:
+        friend class Model;
+
+        // a two-level tree indexed by Handle. publishing copies only the
+        // paths to changed slots and shares the rest with the previous snapshot.
+        static constexpr size_t FANOUT {64};
+        typedef std::array<std::shared_ptr<const Transfer>,FANOUT> Chunk;
+        typedef std::array<std::shared_ptr<const Chunk>,FANOUT> Page;
+        std::vector<std::shared_ptr<const Page>> m_pages;
+
+        // a copy of the model's id index as of publishing. it's only
+        // copied again when transfers are added or removed.
+        std::shared_ptr<const std::vector<Handle>> m_index {std::make_shared<const std::vector<Handle>>()};
+
+        Generation m_generation = 0;
+        int m_size = 0;
+        Totals m_totals;
+    };
+
+    /**
+     * Returns a snapshot of the model as of the last batch that ended.
+     * Snapshots are built lazily: when called on the thread that created
+     * the model, this builds a new one if a batch has ended since the
+     * last one, copying only the transfers that were added or changed.
+     * Other threads never copy anything. They get the latest one that
+     * was built, and ask the model's thread to build the next one: it
+     * does so from an idle in its thread-default GMainContext, or when
+     * its next batch ends, whichever comes first.
+     */
+    std::shared_ptr<const Snapshot> snapshot() const;
+
 protected:
-    std::map<Transfer::Id,std::shared_ptr<Transfer>> m_transfers;
+    Handle insert(const std::shared_ptr<Transfer>&);
+    void erase(Handle);
+    void touch(Handle);
+    void replace(Handle, const std::shared_ptr<Transfer>&);
+    void publish_snapshot() const;
+
+    struct Slot
+    {
+        std::shared_ptr<Transfer> transfer; // nullptr if the slot is free
+        size_t hash = 0;
+        Generation added = 0;
+        Generation modified = 0;
+        int64_t retired_usec = 0; // when it finished, was canceled, or failed
+        size_t n_bytes = 0;       // approximate memory used, as of the last add or change
+        uint8_t can = 0;          // CAN_* answers, as of the last add or change
+        mutable bool unpublished = false; // changed since the last snapshot
+    };
+
+    // the transfers, densely packed and indexed by Handle
+    std::vector<Slot> m_slots;
+    std::vector<Handle> m_free_slots;
+
+    // open-addressed hash table of Id -> Handle, with linear probing.
+    // its size is zero or a power of two, and is kept at least twice m_size.
+    std::vector<Handle> m_index;
+    int m_size = 0;
+    size_t m_n_bytes = 0; // the sum of the slots' n_bytes
+
+    // the retired transfers, oldest first, so that pruning never has to sort
+    std::set<std::pair<int64_t,Handle>> m_retired;
+
+    // snapshot() only builds a new snapshot between batches
+    int m_batch_depth = 0;
+    mutable bool m_snapshot_stale = false;
+
+    // set when another thread wants a fresher snapshot than it got
+    mutable std::atomic<bool> m_snapshot_requested {false};
+
     core::Signal<Transfer::Id> m_changed;
     core::Signal<Transfer::Id> m_added;
     core::Signal<Transfer::Id> m_removed;
+    core::Signal<Changes> m_batch;
+
+private:
+    size_t find_bucket(const Transfer::Id&, size_t hash) const;
+    void rehash(size_t n_buckets);
+    void log_removal(const Slot&, Generation);
+    void add_slot();
+    void add_to_totals(Handle);
+    void remove_from_totals(Handle);
+    void set_retired_usec(Handle, int64_t retired_usec);
+    enum : uint8_t { CAN_PAUSE = (1<<0), CAN_RESUME = (1<<1), CAN_CLEAR = (1<<2) };
+    void mark_unpublished(Handle);
+    void request_snapshot() const;
+    static gboolean on_snapshot_idle(gpointer gself);
+
+    Generation m_generation = 0;
+    Totals m_totals;
+    Columns m_columns;
+
+    // recently removed transfers, oldest first, for changes_since().
+    // removals at or before m_removals_horizon have been forgotten.
+    struct Removal
+    {
+        Generation generation;
+        Generation added;
+        Transfer::Id id;
+    };
+    static constexpr size_t MAX_REMOVALS {1024};
+    std::deque<Removal> m_removals;
+    Generation m_removals_horizon = 0;
+
+    // the handles whose slots changed since the last publish_snapshot(),
+    // and whether any of them were added or removed.
+    // m_snapshot is replaced, never changed; use std::atomic_load() and std::atomic_store()
+    mutable std::vector<Handle> m_unpublished;
+    mutable bool m_index_unpublished = false;
+    mutable std::shared_ptr<const Snapshot> m_snapshot {std::make_shared<const Snapshot>()};
+    const std::thread::id m_thread {std::this_thread::get_id()};
+
+    // the pending idle that builds a snapshot that another thread asked for
+    GMainContext* const m_context {g_main_context_ref_thread_default()};
+    mutable std::mutex m_snapshot_idle_mutex;
+    mutable GSource* m_snapshot_idle = nullptr;
+
+    class WalkGuard
+    {
+    public:
+        explicit WalkGuard(const Model& model);
+        ~WalkGuard();
+    private:
+        const Model& m_model;
+    };
+
+    // while for_each() is walking m_slots, freed slots aren't reused
+    // and removed transfers are kept in a graveyard until the walk ends
+    mutable int m_walk_depth = 0;
+    mutable std::vector<Handle> m_walk_freed_slots;
+    mutable std::vector<std::shared_ptr<Transfer>> m_walk_graveyard;
 };
 
 /**
@@ -65,7 +406,64 @@ public:
     ~MutableModel();
     void add(const std::shared_ptr<Transfer>& add_me);
     void remove(const Transfer::Id&);
-    void emit_changed(const Transfer::Id&);
+    void emit_changed(const Transfer::Id&, Transfer::Fields=Transfer::ALL_FIELDS);
+
+    /**
+     * Swaps in a new copy of a transfer and emits it as changed,
+     * or adds it if there's no transfer with its id.
+     * Listeners holding the old copy can keep reading it safely.
+     */
+    void update(const std::shared_ptr<Transfer>&, Transfer::Fields=Transfer::ALL_FIELDS);
+
+    /**
+     * Batches can nest. The batch() signal is emitted
+     * when the outermost batch ends.
+     */
+    void begin_batch();
+    void end_batch();
+
+    /**
+     * Limits on the finished, canceled, and failed transfers that are kept.
+     * Transfers that are still active are never evicted. Zero means no limit.
+     */
+    struct RetentionPolicy
+    {
+        int max_count = 0;     // retired transfers
+        int max_age_sec = 0;   // time since a transfer retired
+        size_t max_bytes = 0;  // approximate memory used by all the transfers
+    };
+    void set_retention_policy(const RetentionPolicy&);
+    const RetentionPolicy& get_retention_policy() const;
+
+    struct RetentionStats
+    {
+        uint64_t n_prunes = 0;
+        uint64_t n_evicted_for_age = 0;
+        uint64_t n_evicted_for_count = 0;
+        uint64_t n_evicted_for_bytes = 0;
+    };
+    const RetentionStats& get_retention_stats() const;
+
+    /**
+     * Removes the retired transfers that the retention policy no longer
+     * allows, oldest first, in a single batch. The policy isn't applied
+     * on its own: sources call prune() after their changes are flushed,
+     * which is free unless the count or memory is over budget, and
+     * prune_expired() from a timer if there's a maximum age. The retired
+     * transfers are kept in order, so neither one scans the whole model.
+     * Both return the evicted transfers so that the caller can forget them too.
+     */
+    std::vector<std::shared_ptr<Transfer>> prune();
+    std::vector<std::shared_ptr<Transfer>> prune_expired();
+    std::vector<std::shared_ptr<Transfer>> prune_expired(int64_t now_usec);
+
+private:
+    void flush_batch();
+    void remove_evicted(const std::vector<std::shared_ptr<Transfer>>&);
+
+    Changes m_pending;
+    RetentionPolicy m_retention_policy;
+    RetentionStats m_retention_stats;
 };
 
 
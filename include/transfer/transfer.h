@@ -24,7 +24,10 @@
 
 #include <gio/gio.h> // GIcon
 
+#include <cstdint> // uint32_t
 #include <ctime> // time_t
+#include <functional> // std::hash
+#include <iosfwd> // std::ostream
 #include <memory>
 #include <string>
 #include <vector>
@@ -38,6 +41,12 @@ namespace transfer {
  */
 struct Transfer
 {
+  Transfer() =default;
+
+  // copies are deep, so a source can hand off a snapshot of a transfer
+  Transfer(const Transfer&);
+  Transfer& operator=(const Transfer&);
+
   typedef enum { QUEUED, RUNNING, PAUSED, CANCELED,
                  HASHING, PROCESSING, FINISHED,
                  ERROR } State;
@@ -61,24 +70,113 @@ struct Transfer
 
   uint64_t total_size = 0;
 
-  typedef std::string Id;
+  /**
+   * An interned transfer id: a 32-bit value that's cheap to copy,
+   * compare, and hash. Its string form is only built when it's needed,
+   * e.g. for D-Bus, and the same string always yields the same Id.
+   *
+   * Decimal strings, like the ones next_unique_id() hands out, are their
+   * own value and take no memory. Other strings are interned for the life
+   * of the process, so strings from outside that are only used to look
+   * up an existing transfer should go through find() instead. That's also
+   * why building an Id from a string has to be spelled out.
+   */
+  class Id
+  {
+  public:
+    Id() =default;
+    explicit Id(const std::string&);
+    explicit Id(const char*);
+
+    // the string's Id if it has one, or the empty Id. never interns anything.
+    static Id find(const std::string&);
+    static Id find(const char*);
+
+    std::string str() const;
+    bool empty() const {return m_value == 0;}
+    uint32_t value() const {return m_value;}
+
+    friend bool operator==(const Id& a, const Id& b) {return a.m_value == b.m_value;}
+    friend bool operator!=(const Id& a, const Id& b) {return a.m_value != b.m_value;}
+    friend bool operator<(const Id& a, const Id& b) {return a.m_value < b.m_value;}
+
+  private:
+    friend struct Transfer;
+    explicit Id(uint32_t value): m_value(value) {}
+    uint32_t m_value = 0; // 0 is the empty id
+  };
   Id id;
   std::string title;
+
+  // the full path of an existing icon file, or a themed icon name.
+  // views don't touch the filesystem, so sources must resolve this.
   std::string app_icon;
-  std::string custom_state;
+
+  // These are empty for most of a transfer's life,
+  // so they're kept out of line until one is set.
+  const std::string& custom_state() const;
+  void set_custom_state(const std::string&);
 
   // meaningful iff state is ERROR
-  std::string error_string;
+  const std::string& error_string() const;
+  void set_error_string(const std::string&);
 
   // meaningful iff state is FINISHED
-  std::string local_path;
+  const std::string& local_path() const;
+  void set_local_path(const std::string&);
+
+  // approximately how much memory the transfer uses, for retention budgets
+  virtual size_t memory_usage() const;
+
+  // bitflags that tell model listeners which fields changed
+  enum Field : uint32_t
+  {
+    FIELD_PROGRESS     = (1<<0),
+    FIELD_SECONDS_LEFT = (1<<1),
+    FIELD_SPEED        = (1<<2),
+    FIELD_TOTAL_SIZE   = (1<<3),
+    FIELD_STATE        = (1<<4),
+    FIELD_CUSTOM_STATE = (1<<5),
+    FIELD_TITLE        = (1<<6),
+    FIELD_APP_ICON     = (1<<7),
+    FIELD_LOCAL_PATH   = (1<<8),
+    FIELD_ERROR_STRING = (1<<9),
+    FIELD_TIME_STARTED = (1<<10),
+    ALL_FIELDS         = 0xFFFFFFFF
+  };
+  typedef uint32_t Fields;
+
+  // makes next_unique_id() skip past this id, e.g. after restoring it from a Journal
+  static void reserve_unique_id(const Id& id);
 
 protected:
-  static std::string next_unique_id();
+  static Id next_unique_id();
+
+private:
+  struct Extras
+  {
+    std::string custom_state;
+    std::string error_string;
+    std::string local_path;
+  };
+  std::unique_ptr<Extras> m_extras; // nullptr until a field in it is set
+  Extras& extras();
 };
 
+std::ostream& operator<<(std::ostream&, const Transfer::Id&);
+
 } // namespace transfer
 } // namespace indicator
 } // namespace unity
 
+namespace std {
+  template<> struct hash<unity::indicator::transfer::Transfer::Id>
+  {
+    size_t operator()(const unity::indicator::transfer::Transfer::Id& id) const
+    {
+      return id.value();
+    }
+  };
+}
+
 #endif // INDICATOR_TRANSFER_TRANSFER_H
@@ -0,0 +1,317 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "app-info-cache.h"
+
+#include <ubuntu-app-launch.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+namespace unity {
+namespace indicator {
+namespace transfer {
+
+namespace {
+
+// how long to remember lookups that can change without a mtime to watch
+static constexpr int64_t NEGATIVE_TTL_USEC {60 * G_USEC_PER_SEC};
+static constexpr int64_t APP_ID_TTL_USEC {60 * G_USEC_PER_SEC};
+
+// lookups are I/O bound, and a couple of threads is plenty for that
+static constexpr int MAX_WORKER_THREADS {2};
+
+} // anonymous namespace
+
+struct AppInfoCache::Task
+{
+  std::string app_id;
+  std::string package_name;
+  GCancellable* cancellable;
+  GMainContext* context;
+  IconFunc func;
+  std::string icon;
+};
+
+/***
+****
+***/
+
+AppInfoCache::AppInfoCache()
+{
+  GError* error = nullptr;
+  m_pool = g_thread_pool_new(worker_func, this, MAX_WORKER_THREADS, false, &error);
+  if (error != nullptr)
+    {
+      g_warning("Unable to create app info thread pool: %s", error->message);
+      g_error_free(error);
+    }
+}
+
+AppInfoCache::~AppInfoCache()
+{
+  // the workers use 'this', so wait for them. the queued tasks are dropped
+  // rather than looked up, and the main loop is gone, so nobody's called back.
+  if (m_pool != nullptr)
+    {
+      m_shutting_down = true;
+      g_thread_pool_free(m_pool, false, true);
+      m_pool = nullptr;
+    }
+}
+
+AppInfoCache& AppInfoCache::get_default()
+{
+  static AppInfoCache cache;
+  return cache;
+}
+
+void AppInfoCache::get_icon_async(const std::string& app_id,
+                                  const std::string& package_name,
+                                  GCancellable* cancellable,
+                                  const IconFunc& func)
+{
+  auto task = new Task{app_id,
+                       package_name,
+                       cancellable ? G_CANCELLABLE(g_object_ref(cancellable)) : nullptr,
+                       g_main_context_ref_thread_default(),
+                       func,
+                       std::string()};
+
+  // if we couldn't make a pool, fall back to blocking lookups
+  if (m_pool != nullptr)
+    g_thread_pool_push(m_pool, task, nullptr);
+  else
+    worker_func(task, this);
+}
+
+void AppInfoCache::worker_func(gpointer gtask, gpointer gself)
+{
+  auto task = static_cast<Task*>(gtask);
+  auto self = static_cast<AppInfoCache*>(gself);
+
+  if (self->m_shutting_down)
+    {
+      free_task(task);
+      return;
+    }
+
+  if (!g_cancellable_is_cancelled(task->cancellable))
+    {
+      if (!task->app_id.empty())
+        task->icon = self->get_icon_for_app_id(task->app_id);
+      else if (!task->package_name.empty())
+        task->icon = self->get_icon_for_package(task->package_name);
+    }
+
+  // marshal the result back to the thread that asked for it
+  g_main_context_invoke(task->context, on_task_done, task);
+}
+
+gboolean AppInfoCache::on_task_done(gpointer gtask)
+{
+  auto task = static_cast<Task*>(gtask);
+
+  if (!g_cancellable_is_cancelled(task->cancellable))
+    task->func(task->icon);
+
+  free_task(task);
+  return G_SOURCE_REMOVE;
+}
+
+void AppInfoCache::free_task(Task* task)
+{
+  g_clear_object(&task->cancellable);
+  g_main_context_unref(task->context);
+  delete task;
+}
+
+std::string AppInfoCache::get_icon_for_app_id(const std::string& app_id)
+{
+  const auto now = g_get_monotonic_time();
+
+  // copy the cached entry so that we don't hold the lock during I/O
+  bool cached = false;
+  IconEntry entry;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_icons.find(app_id);
+    if ((cached = (it != m_icons.end())))
+      entry = it->second;
+  }
+
+  if (cached)
+    {
+      const bool fresh = entry.desktop_file.empty()
+                       ? (now < entry.expires_usec)
+                       : (get_mtime(entry.desktop_file) == entry.mtime);
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (fresh)
+        {
+          ++m_stats.hits;
+          return entry.icon;
+        }
+
+      ++m_stats.invalidations;
+    }
+
+  entry = IconEntry();
+  if (!resolve_icon(app_id, entry))
+    entry.expires_usec = now + NEGATIVE_TTL_USEC;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  ++m_stats.misses;
+  m_icons[app_id] = entry;
+  return entry.icon;
+}
+
+std::string AppInfoCache::get_icon_for_package(const std::string& package_name)
+{
+  const auto app_id = get_app_id_for_package(package_name);
+
+  if (app_id.empty())
+    return std::string();
+
+  return get_icon_for_app_id(app_id);
+}
+
+std::string AppInfoCache::get_app_id_for_package(const std::string& package_name)
+{
+  const auto now = g_get_monotonic_time();
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_app_ids.find(package_name);
+    if ((it != m_app_ids.end()) && (now < it->second.expires_usec))
+      {
+        ++m_stats.hits;
+        return it->second.app_id;
+      }
+  }
+
+  AppIdEntry entry;
+  auto app_id = ubuntu_app_launch_triplet_to_app_id(package_name.c_str(),
+                                                    "first-listed-app",
+                                                    "current-user-version");
+  if (app_id != nullptr)
+    entry.app_id = app_id;
+  else
+    g_warning("fail to retrive app-id from package: %s", package_name.c_str());
+  g_free(app_id);
+
+  entry.expires_usec = now + APP_ID_TTL_USEC;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  ++m_stats.misses;
+  m_app_ids[package_name] = entry;
+  return entry.app_id;
+}
+
+AppInfoCache::Stats AppInfoCache::get_stats() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto stats = m_stats;
+  stats.n_entries = m_icons.size() + m_app_ids.size();
+  return stats;
+}
+
+void AppInfoCache::clear()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_icons.clear();
+  m_app_ids.clear();
+}
+
+/***
+****
+***/
+
+bool AppInfoCache::resolve_icon(const std::string& app_id, IconEntry& setme)
+{
+  gchar *app_dir;
+  gchar *app_desktop_file;
+
+  if (!ubuntu_app_launch_application_info(app_id.c_str(), &app_dir, &app_desktop_file))
+    {
+      g_warning("Fail to get app info: %s", app_id.c_str());
+      return false;
+    }
+
+  g_debug("App data: %s : %s", app_dir, app_desktop_file);
+  gchar *full_app_desktop_file = g_build_filename(app_dir, app_desktop_file, nullptr);
+  GKeyFile *app_info = g_key_file_new();
+  GError *error = nullptr;
+  bool found = false;
+
+  g_debug("Open desktop file: %s", full_app_desktop_file);
+  g_key_file_load_from_file(app_info, full_app_desktop_file, G_KEY_FILE_NONE, &error);
+  if (error)
+    {
+      g_warning("Fail to open desktop info: %s:%s", full_app_desktop_file, error->message);
+      g_error_free(error);
+    }
+  else
+    {
+      gchar *icon_name = g_key_file_get_string(app_info, "Desktop Entry", "Icon", &error);
+      if (error == nullptr)
+        {
+          gchar *full_icon_name = g_build_filename(app_dir, icon_name, nullptr);
+          g_debug("App icon: %s", icon_name);
+          g_debug("App full icon name: %s", full_icon_name);
+          // check if it is full path icon or a themed one
+          if (g_file_test(full_icon_name, G_FILE_TEST_EXISTS))
+            setme.icon = full_icon_name;
+          else
+            setme.icon = icon_name;
+          g_free(full_icon_name);
+
+          setme.desktop_file = full_app_desktop_file;
+          setme.mtime = get_mtime(full_app_desktop_file);
+          found = true;
+        }
+      else
+        {
+          g_warning("Fail to retrive icon: %s", error->message);
+          g_error_free(error);
+        }
+      g_free(icon_name);
+    }
+
+  g_key_file_free(app_info);
+  g_free(full_app_desktop_file);
+  g_free(app_dir);
+  g_free(app_desktop_file);
+  return found;
+}
+
+int64_t AppInfoCache::get_mtime(const std::string& filename)
+{
+  GStatBuf buf;
+
+  if (g_stat(filename.c_str(), &buf) != 0)
+    return -1;
+
+  return buf.st_mtime;
+}
+
+/***
+****
+***/
+
+} // namespace transfer
+} // namespace indicator
+} // namespace unity
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDICATOR_TRANSFER_APP_INFO_CACHE_H
+#define INDICATOR_TRANSFER_APP_INFO_CACHE_H
+
+#include <gio/gio.h> // GCancellable
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace unity {
+namespace indicator {
+namespace transfer {
+
+/**
+ * \brief Process-wide cache of app-id and package-name to icon lookups
+ *
+ * Finding an app's icon means asking ubuntu-app-launch where the app
+ * lives and parsing its .desktop file, and many transfers usually share
+ * the same few apps. Results are cached, including failed lookups.
+ * A cached icon is re-resolved when its .desktop file's mtime changes;
+ * failed lookups and package-name mappings expire after a short while
+ * since they change when apps are installed or updated.
+ *
+ * The lookups block on the filesystem, so code running in the main loop
+ * should use get_icon_async(). It resolves the icon on a worker thread
+ * and invokes the callback back in the caller's thread-default context.
+ */
+class AppInfoCache
+{
+public:
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t invalidations = 0;
+        size_t n_entries = 0;
+    };
+
+    typedef std::function<void(const std::string& icon)> IconFunc;
+
+    static AppInfoCache& get_default();
+
+    // uses app_id if it's not empty, else package_name.
+    // func isn't called if the cancellable is cancelled first.
+    void get_icon_async(const std::string& app_id,
+                        const std::string& package_name,
+                        GCancellable* cancellable,
+                        const IconFunc& func);
+
+    // returns the icon's full path, a themed icon name, or "" if unknown
+    std::string get_icon_for_app_id(const std::string& app_id);
+    std::string get_icon_for_package(const std::string& package_name);
+
+    // returns the package's first listed app, or "" if unknown
+    std::string get_app_id_for_package(const std::string& package_name);
+
+    Stats get_stats() const;
+    void clear();
+
+private:
+
+    AppInfoCache();
+    ~AppInfoCache();
+
+    struct IconEntry
+    {
+        std::string icon;
+        std::string desktop_file;
+        int64_t mtime = 0;
+        int64_t expires_usec = 0; // only for failed lookups
+    };
+
+    struct AppIdEntry
+    {
+        std::string app_id;
+        int64_t expires_usec = 0;
+    };
+
+    struct Task;
+
+    static bool resolve_icon(const std::string& app_id, IconEntry& setme);
+    static int64_t get_mtime(const std::string& filename);
+    static void worker_func(gpointer task, gpointer gself);
+    static gboolean on_task_done(gpointer task);
+    static void free_task(Task* task);
+
+    // guards everything below
+    mutable std::mutex m_mutex;
+    std::map<std::string,IconEntry> m_icons;
+    std::map<std::string,AppIdEntry> m_app_ids;
+    Stats m_stats;
+    GThreadPool* m_pool = nullptr;
+    std::atomic<bool> m_shutting_down {false}; // the workers drop their tasks
+
+    AppInfoCache(const AppInfoCache&) =delete;
+    AppInfoCache& operator=(const AppInfoCache&) =delete;
+};
+
+} // namespace transfer
+} // namespace indicator
+} // namespace unity
+
+#endif // INDICATOR_TRANSFER_APP_INFO_CACHE_H
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "change-scheduler.h"
+
+#include <algorithm> // std::max()
+
+namespace unity {
+namespace indicator {
+namespace transfer {
+
+/***
+****
+***/
+
+ChangeScheduler::ChangeScheduler(unsigned int interval_msec,
+                                 const FlushFunc& flush,
+                                 const std::shared_ptr<Pool>& pool):
+  m_flush(flush),
+  m_interval_msec(interval_msec),
+  m_dirty{DirtyMap(DirtyAllocator(pool)), DirtyMap(DirtyAllocator(pool))}
+{
+}
+
+ChangeScheduler::~ChangeScheduler()
+{
+  for (const auto& tag : m_tags)
+    if (tag)
+      g_source_remove(tag);
+}
+
+void ChangeScheduler::set_interval(unsigned int interval_msec)
+{
+  m_interval_msec = interval_msec;
+}
+
+void ChangeScheduler::schedule(const Transfer::Id& id, Lane lane)
+{
+  // a pending urgent flush will carry this change too
+  if ((lane == THROTTLED) && m_dirty[URGENT].count(id))
+    return;
+
+  // ...and an urgent flush supersedes a pending throttled one
+  if (lane == URGENT)
+    m_dirty[THROTTLED].erase(id);
+
+  // emplace() keeps the oldest timestamp if the id's already dirty
+  m_dirty[lane].emplace(id, g_get_monotonic_time());
+
+  if (m_tags[lane] == 0)
+    {
+      if (lane == URGENT)
+        m_tags[lane] = g_idle_add(on_urgent_tick, this);
+      // whole seconds let glib batch our wakeups with other timers'
+      else if (m_interval_msec % 1000 == 0)
+        m_tags[lane] = g_timeout_add_seconds(m_interval_msec / 1000, on_throttled_tick, this);
+      else
+        m_tags[lane] = g_timeout_add(m_interval_msec, on_throttled_tick, this);
+    }
+}
+
+void ChangeScheduler::unschedule(const Transfer::Id& id)
+{
+  for (auto& dirty : m_dirty)
+    dirty.erase(id);
+}
+
+const ChangeScheduler::LaneStats& ChangeScheduler::stats(Lane lane) const
+{
+  return m_stats[lane];
+}
+
+gboolean ChangeScheduler::on_urgent_tick(gpointer gself)
+{
+  static_cast<ChangeScheduler*>(gself)->flush(URGENT);
+  return G_SOURCE_REMOVE;
+}
+
+gboolean ChangeScheduler::on_throttled_tick(gpointer gself)
+{
+  static_cast<ChangeScheduler*>(gself)->flush(THROTTLED);
+  return G_SOURCE_REMOVE;
+}
+
+void ChangeScheduler::flush(Lane lane)
+{
+  m_tags[lane] = 0;
+
+  // swap out the dirty set in case flushing reschedules something
+  DirtyMap dirty(m_dirty[lane].get_allocator());
+  dirty.swap(m_dirty[lane]);
+
+  // everything in the lane was unscheduled
+  if (dirty.empty())
+    return;
+
+  auto& stats = m_stats[lane];
+  const auto now = g_get_monotonic_time();
+  int64_t max_latency_usec = 0;
+  std::vector<Transfer::Id> ids;
+  ids.reserve(dirty.size());
+  for (const auto& it : dirty)
+    {
+      const auto latency_usec = now - it.second;
+      max_latency_usec = std::max(max_latency_usec, latency_usec);
+      stats.total_latency_usec += latency_usec;
+      ids.push_back(it.first);
+    }
+  m_flush(ids);
+
+  ++stats.n_flushes;
+  stats.n_changes += dirty.size();
+  stats.max_latency_usec = std::max(stats.max_latency_usec, max_latency_usec);
+
+  g_debug("%s: flushed %zu %s changes, max latency %.1f msec",
+          G_STRFUNC, dirty.size(), lane == URGENT ? "urgent" : "throttled",
+          max_latency_usec / 1000.0);
+}
+
+} // namespace transfer
+} // namespace indicator
+} // namespace unity
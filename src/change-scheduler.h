@@ -0,0 +1,99 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDICATOR_TRANSFER_CHANGE_SCHEDULER_H
+#define INDICATOR_TRANSFER_CHANGE_SCHEDULER_H
+
+#include <transfer/transfer.h>
+
+#include "pool.h"
+
+#include <glib.h> // guint, gpointer
+
+#include <cstdint> // int64_t, uint64_t
+#include <functional>
+#include <map>
+#include <memory> // std::shared_ptr
+#include <vector>
+
+namespace unity {
+namespace indicator {
+namespace transfer {
+
+/**
+ * \brief Coalesces change notifications from a Source's transfers.
+ *
+ * Rather than each transfer arming its own timer, dirty transfers are
+ * collected here and flushed together on a shared tick. There are two
+ * lanes: URGENT changes (state, errors, paths) are flushed on the next
+ * idle so that user actions get prompt feedback, while THROTTLED changes
+ * (progress, speed, ETA) are rate-limited to one flush per interval.
+ * No source is armed for a lane while nothing in it is dirty.
+ */
+class ChangeScheduler
+{
+public:
+
+    // called once per flush with all of the lane's dirty ids
+    typedef std::function<void(const std::vector<Transfer::Id>&)> FlushFunc;
+
+    enum Lane { URGENT, THROTTLED, NUM_LANES };
+
+    struct LaneStats
+    {
+        uint64_t n_flushes = 0;
+        uint64_t n_changes = 0;
+        int64_t total_latency_usec = 0; // time from schedule() to flush
+        int64_t max_latency_usec = 0;
+    };
+
+    ChangeScheduler(unsigned int interval_msec, const FlushFunc& flush, const std::shared_ptr<Pool>& pool);
+    ~ChangeScheduler();
+
+    // takes effect the next time the THROTTLED lane's timer is armed
+    void set_interval(unsigned int interval_msec);
+
+    void schedule(const Transfer::Id& id, Lane lane);
+    void unschedule(const Transfer::Id& id);
+
+    const LaneStats& stats(Lane lane) const;
+
+private:
+
+    static gboolean on_urgent_tick(gpointer gself);
+    static gboolean on_throttled_tick(gpointer gself);
+    void flush(Lane lane);
+
+    // dirty ids churn on every tick, so keep their nodes in the Source's pool
+    typedef PoolAllocator<std::pair<const Transfer::Id,int64_t>> DirtyAllocator;
+    typedef std::map<Transfer::Id,int64_t,std::less<Transfer::Id>,DirtyAllocator> DirtyMap;
+
+    const FlushFunc m_flush;
+    unsigned int m_interval_msec;
+    DirtyMap m_dirty[NUM_LANES];
+    LaneStats m_stats[NUM_LANES];
+    guint m_tags[NUM_LANES] = {};
+
+    // we've got gsource tags in here, so disable copying
+    ChangeScheduler(const ChangeScheduler&) =delete;
+    ChangeScheduler& operator=(const ChangeScheduler&) =delete;
+};
+
+} // namespace transfer
+} // namespace indicator
+} // namespace unity
+
+#endif // INDICATOR_TRANSFER_CHANGE_SCHEDULER_H
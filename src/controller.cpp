@@ -38,20 +38,23 @@ Controller::~Controller()
 
 void Controller::pause_all()
 {
-  for(const auto& id : get_ids())
-    pause(id);
+  m_source->get_model()->for_each([this](const Transfer& transfer){
+    pause(transfer.id);
+  });
 }
 
 void Controller::resume_all()
 {
-  for(const auto& id : get_ids())
-    resume(id);
+  m_source->get_model()->for_each([this](const Transfer& transfer){
+    resume(transfer.id);
+  });
 }
 
 void Controller::clear_all()
 {
-  for (const auto& id : get_ids())
-    clear(id);
+  m_source->get_model()->for_each([this](const Transfer& transfer){
+    clear(transfer.id);
+  });
 }
 
 void Controller::tap(const Transfer::Id& id)
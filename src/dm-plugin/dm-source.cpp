@@ -19,6 +19,13 @@
 
 #include <transfer/dm-source.h>
 
+#include "app-info-cache.h"
+#include "change-scheduler.h"
+#include "journal.h"
+#include "pool.h"
+#include "throughput-estimator.h"
+#include "tombstone-set.h"
+
 #include <click.h>
 #include <ubuntu-app-launch.h>
 
@@ -27,7 +34,10 @@
 #include <gio/gdesktopappinfo.h>
 
 #include <algorithm>
+#include <functional>
 #include <iostream>
+#include <set>
+#include <unordered_map>
 
 namespace unity {
 namespace indicator {
@@ -37,8 +47,25 @@ namespace {
 
 static constexpr char const * DM_BUS_NAME {"com.canonical.applications.Downloader"};
 static constexpr char const * DM_MANAGER_IFACE_NAME {"com.canonical.applications.DownloadManager"};
+static constexpr char const * DM_MANAGER_PATH {"/"};
 static constexpr char const * DM_DOWNLOAD_IFACE_NAME {"com.canonical.applications.Download"};
 
+/**
+ * A transfer restored from the Journal, shown until DownloadManager
+ * tells us about it again. There's nothing behind it to start, pause,
+ * resume or cancel, so it doesn't offer to; it can only be cleared.
+ */
+class RestoredTransfer: public Transfer
+{
+public:
+  explicit RestoredTransfer(const Transfer& transfer): Transfer(transfer) {}
+
+  bool can_start() const override {return false;}
+  bool can_resume() const override {return false;}
+  bool can_pause() const override {return false;}
+  bool can_cancel() const override {return false;}
+};
+
 /**
  * A Transfer whose state comes from content-hub and ubuntu-download-manager.
  *
@@ -51,28 +78,45 @@ class DMTransfer: public Transfer
 {
 public:
 
+  /**
+   * \param properties the ccad's a{sv} properties from GetAll(), or nullptr
+   */
   DMTransfer(GDBusConnection* connection,
-             const std::string& ccad_path):
+             ChangeScheduler* scheduler,
+             const std::string& ccad_path,
+             GVariant* properties):
+    m_scheduler(scheduler),
     m_bus(G_DBUS_CONNECTION(g_object_ref(connection))),
     m_cancellable(g_cancellable_new()),
     m_ccad_path(ccad_path)
   {
     id = next_unique_id();
     time_started = time(nullptr);
-    get_ccad_properties();
+    bootstrap(properties);
   }
 
   ~DMTransfer()
   {
-    if (m_changed_tag)
-      g_source_remove(m_changed_tag);
-
-    g_cancellable_cancel(m_cancellable);
+    detach();
     g_clear_object(&m_cancellable);
     g_clear_object(&m_bus);
   }
 
-  core::Signal<>& changed() { return m_changed; }
+  size_t memory_usage() const override
+  {
+    return Transfer::memory_usage()
+         + (sizeof(DMTransfer) - sizeof(Transfer))
+         + m_app_id.capacity()
+         + m_package_name.capacity()
+         + m_ccad_path.capacity();
+  }
+
+  // called when our DMSource goes away before we do
+  void detach()
+  {
+    g_cancellable_cancel(m_cancellable);
+    m_scheduler = nullptr;
+  }
 
   void start()
   {
@@ -107,13 +151,10 @@ public:
 
   void open_app()
   {
-    // destination app has priority over app_id
-    std::string app_id = download_app_id();
+    std::string app_id = m_app_id;
 
     if (app_id.empty() && !m_package_name.empty()) {
-        app_id = std::string(ubuntu_app_launch_triplet_to_app_id(m_package_name.c_str(),
-                                                                 "first-listed-app",
-                                                                 "current-user-version"));
+        app_id = AppInfoCache::get_default().get_app_id_for_package(m_package_name);
     }
 
     if (app_id.empty())
@@ -132,6 +173,14 @@ public:
     return m_ccad_path;
   }
 
+  // returns the fields changed since the last call, and resets them
+  Fields take_dirty_fields()
+  {
+    const auto fields = m_dirty_fields;
+    m_dirty_fields = 0;
+    return fields;
+  }
+
   void handle_ccad_signal(const gchar* signal_name, GVariant* parameters)
   {
     if (!g_strcmp0(signal_name, "started"))
@@ -214,23 +263,16 @@ public:
 
 private:
 
-  const std::string& download_app_id() const
+  void emit_changed_soon(Fields fields, ChangeScheduler::Lane lane = ChangeScheduler::URGENT)
   {
-       return m_app_id.empty() ? m_destination_app : m_app_id;
-  }
+    m_dirty_fields |= fields;
 
-  void emit_changed_soon()
-  {
-    if (m_changed_tag == 0)
-        m_changed_tag = g_timeout_add_seconds(1, emit_changed_now, this);
-  }
+    // while bootstrapping, changes are folded into a single emission
+    if (m_bootstrap_pending > 0)
+      return;
 
-  static gboolean emit_changed_now(gpointer gself)
-  {
-    auto self = static_cast<DMTransfer*>(gself);
-    self->m_changed_tag = 0;
-    self->m_changed();
-    return G_SOURCE_REMOVE;
+    if (m_scheduler != nullptr)
+      m_scheduler->schedule(id, lane);
   }
 
   /* The 'started', 'paused', 'resumed', and 'canceled' signals
@@ -245,34 +287,6 @@ private:
     return success;
   }
 
-  uint64_t get_averaged_speed_Bps()
-  {
-    // limit the average to the last X samples
-    static constexpr int max_slots = 50;
-    if (m_history.size() > max_slots)
-      m_history.erase(m_history.begin(), m_history.end()-max_slots);
-
-    // limit the average to the last Y seconds
-    static constexpr unsigned int max_age_seconds = 30;
-    const auto oldest_allowed_usec = g_get_real_time() - (max_age_seconds * G_USEC_PER_SEC);
-    const auto is_young = [oldest_allowed_usec](const DownloadProgress& p){return p.time_usec >= oldest_allowed_usec;};
-    m_history.erase(std::begin(m_history), std::find_if(std::begin(m_history), std::end(m_history), is_young));
-
-    uint64_t Bps;
-
-    if (m_history.size() < 2)
-      {
-        Bps = 0;
-      }
-    else
-      {
-        const auto diff = m_history.back() - m_history.front();
-        Bps = (diff.bytes * G_USEC_PER_SEC) / diff.time_usec;
-      }
-
-    return Bps;
-  }
-
   void update_progress()
   {
     uint64_t tmp_total_size = 0;
@@ -283,9 +297,9 @@ private:
     if (m_total_size && m_received)
       {
         // update our speed tables
-        m_history.push_back(DownloadProgress{g_get_real_time(),m_received});
+        m_estimator.add_sample(m_received);
 
-        const auto Bps = get_averaged_speed_Bps();
+        const auto Bps = m_estimator.get_Bps();
         const int seconds = Bps ? (int)((m_total_size - m_received) / Bps) : -1;
 
         tmp_total_size = m_total_size;
@@ -294,35 +308,36 @@ private:
         tmp_seconds_left = seconds;
       }
 
-    bool changed = false;
+    Fields changed = 0;
 
     if ((int)(progress*100) != (int)(tmp_progress*100))
       {
         progress = tmp_progress;
-        changed = true;
+        changed |= FIELD_PROGRESS;
       }
 
     if (seconds_left != tmp_seconds_left)
       {
         g_debug("changing '%s' seconds_left to '%d'", m_ccad_path.c_str(), (int)tmp_seconds_left);
         seconds_left = tmp_seconds_left;
-        changed = true;
+        changed |= FIELD_SECONDS_LEFT;
       }
 
     if (speed_Bps != tmp_speed_Bps)
       {
         speed_Bps = tmp_speed_Bps;
-        changed = true;
+        changed |= FIELD_SPEED;
       }
 
     if (total_size != tmp_total_size)
       {
         total_size = tmp_total_size;
-        changed = true;
+        changed |= FIELD_TOTAL_SIZE;
       }
 
+    // progress ticks are frequent, so rate-limit them
     if (changed)
-      emit_changed_soon();
+      emit_changed_soon(changed, ChangeScheduler::THROTTLED);
   }
 
   void set_state(State state_in)
@@ -330,36 +345,39 @@ private:
     if (state != state_in)
       {
         state = state_in;
+        Fields changed = FIELD_STATE;
 
         if (!can_pause())
           {
+            if (speed_Bps != 0)
+              changed |= FIELD_SPEED;
             speed_Bps = 0;
-            m_history.clear();
+            m_estimator.reset();
           }
 
-        emit_changed_soon();
+        emit_changed_soon(changed);
       }
   }
 
   void set_error_string(const char* str)
   {
     const std::string tmp = str ? str : "";
-    if (error_string != tmp)
+    if (error_string() != tmp)
     {
       g_debug("changing '%s' error to '%s'", m_ccad_path.c_str(), tmp.c_str());
-      error_string = tmp;
-      emit_changed_soon();
+      Transfer::set_error_string(tmp);
+      emit_changed_soon(FIELD_ERROR_STRING);
     }
   }
 
   void set_local_path(const char* str)
   {
     const std::string tmp = str ? str : "";
-    if (local_path != tmp)
+    if (local_path() != tmp)
       {
         g_debug("changing '%s' path to '%s'", m_ccad_path.c_str(), tmp.c_str());
-        local_path = tmp;
-        emit_changed_soon();
+        Transfer::set_local_path(tmp);
+        emit_changed_soon(FIELD_LOCAL_PATH);
       }
 
     // If we don't already have a title,
@@ -379,7 +397,7 @@ private:
       {
         g_debug("changing '%s' title to '%s'", m_ccad_path.c_str(), tmp.c_str());
         title = tmp;
-        emit_changed_soon();
+        emit_changed_soon(FIELD_TITLE);
       }
   }
 
@@ -390,7 +408,7 @@ private:
       {
         g_debug("changing '%s' icon to '%s'", m_ccad_path.c_str(), tmp.c_str());
         app_icon = tmp;
-        emit_changed_soon();
+        emit_changed_soon(FIELD_APP_ICON);
       }
   }
 
@@ -398,12 +416,37 @@ private:
   ****  DownloadManager
   ***/
 
-  void get_ccad_properties()
+  /* Fetch everything we need to know about a new ccad.
+     The properties come in a single GetAll() call made by DMSource,
+     so only totalSize, progress, and metadata need to be called here.
+     Their results are applied together in one model update. */
+  void bootstrap(GVariant* properties)
   {
     const auto bus_name = DM_BUS_NAME;
     const auto object_path = m_ccad_path.c_str();
     const auto interface_name = DM_DOWNLOAD_IFACE_NAME;
 
+    m_bootstrap_pending = 3;
+
+    if (properties != nullptr)
+      {
+        const char* str = nullptr;
+
+        if (g_variant_lookup(properties, "DestinationApp", "&s", &str))
+          {
+            // the metadata's app-id, if any, replaces this
+            m_app_id = str;
+            g_debug("Destination app: %s", str);
+          }
+
+        if (g_variant_lookup(properties, "Title", "&s", &str))
+          {
+            g_debug("Download title: %s", str);
+            if (str && *str)
+              set_title(str);
+          }
+      }
+
     g_dbus_connection_call(m_bus, bus_name, object_path, interface_name,
                            "totalSize", nullptr, G_VARIANT_TYPE("(t)"),
                            G_DBUS_CALL_FLAGS_NONE, -1,
@@ -418,64 +461,75 @@ private:
                            "metadata", nullptr, G_VARIANT_TYPE("(a{sv})"),
                            G_DBUS_CALL_FLAGS_NONE, -1,
                            m_cancellable, on_ccad_metadata, this);
+  }
 
-    g_dbus_connection_call(m_bus, bus_name, object_path,
-                           "org.freedesktop.DBus.Properties",
-                           "Get", g_variant_new ("(ss)", interface_name, "DestinationApp"),
-                           G_VARIANT_TYPE ("(v)"),
-                           G_DBUS_CALL_FLAGS_NONE, -1,
-                           m_cancellable, on_ccad_destination_app, this);
+  void on_bootstrap_reply()
+  {
+    g_return_if_fail(m_bootstrap_pending > 0);
 
-    g_dbus_connection_call(m_bus, bus_name, object_path,
-                           "org.freedesktop.DBus.Properties",
-                           "Get", g_variant_new ("(ss)", interface_name, "Title"),
-                           G_VARIANT_TYPE ("(v)"),
-                           G_DBUS_CALL_FLAGS_NONE, -1,
-                           m_cancellable, on_ccad_title, this);
+    if (--m_bootstrap_pending > 0)
+      return;
+
+    // all the replies are in, so apply them together
+    update_progress();
+    update_app_info();
+
+    if (m_dirty_fields != 0)
+      emit_changed_soon(m_dirty_fields);
   }
 
   static void on_ccad_total_size(GObject      * source,
                                  GAsyncResult * res,
                                  gpointer       gself)
   {
-    auto v = connection_call_finish(source, res, "Error calling totalSize()");
+    bool cancelled = false;
+    auto v = connection_call_finish(source, res, "Error calling totalSize()", &cancelled);
+    if (cancelled)
+      return;
+
+    auto self = static_cast<DMTransfer*>(gself);
     if (v != nullptr)
       {
         guint64 n = 0;
         g_variant_get_child(v, 0, "t", &n);
         g_variant_unref(v);
-
-        auto self = static_cast<DMTransfer*>(gself);
         self->m_total_size = n;
-        self->update_progress();
       }
+    self->on_bootstrap_reply();
   }
 
   static void on_ccad_progress(GObject      * source,
                                GAsyncResult * res,
                                gpointer       gself)
   {
-    auto v = connection_call_finish(source, res, "Error calling progress()");
+    bool cancelled = false;
+    auto v = connection_call_finish(source, res, "Error calling progress()", &cancelled);
+    if (cancelled)
+      return;
+
+    auto self = static_cast<DMTransfer*>(gself);
     if (v != nullptr)
       {
         guint64 n = 0;
         g_variant_get_child(v, 0, "t", &n);
         g_variant_unref(v);
-
-        auto self = static_cast<DMTransfer*>(gself);
         self->m_received = n;
-        self->update_progress();
       }
+    self->on_bootstrap_reply();
   }
 
   static void on_ccad_metadata(GObject      * source,
                                GAsyncResult * res,
                                gpointer       gself)
   {
-    auto v = connection_call_finish(source, res, "Error calling metadata()");
+    bool cancelled = false;
+    auto v = connection_call_finish(source, res, "Error calling metadata()", &cancelled);
+    if (cancelled)
+      return;
+
+    auto self = static_cast<DMTransfer*>(gself);
     if (v != nullptr)
       {
-        auto self = static_cast<DMTransfer*>(gself);
         GVariant *dict;
         GVariantIter iter;
         GVariant *value;
@@ -484,14 +538,13 @@ private:
         dict = g_variant_get_child_value(v, 0);
         g_variant_iter_init (&iter, dict);
 
-        self->m_app_id = "";
-        self->m_package_name = "";
-
         while (g_variant_iter_next(&iter, "{sv}", &key, &value))
           {
             if (g_strcmp0(key, "app-id") == 0)
               {
-                self->m_app_id = std::string(g_variant_get_string(value, nullptr));
+                const auto app_id = g_variant_get_string(value, nullptr);
+                if (app_id && *app_id)
+                  self->m_app_id = app_id;
               }
 
             // update-manager uses package-name
@@ -506,51 +559,11 @@ private:
           }
 
         g_variant_unref(dict);
+        g_variant_unref(v);
         g_debug("App id: %s", self->m_app_id.c_str());
         g_debug("Package name: %s", self->m_package_name.c_str());
-        self->update_app_info();
-      }
-  }
-
-  static void on_ccad_destination_app(GObject      * source,
-                                      GAsyncResult * res,
-                                      gpointer       gself)
-  {
-    auto v = connection_call_finish(source, res, "Error getting destinationApp property");
-    if (v != nullptr)
-      {
-        GVariant *value, *item;
-        item = g_variant_get_child_value(v, 0);
-        value = g_variant_get_variant(item);
-        g_variant_unref(item);
-
-        auto self = static_cast<DMTransfer*>(gself);
-        self->m_destination_app = std::string(g_variant_get_string(value, nullptr));
-        g_debug("Destination app: %s", self->m_destination_app.c_str());
-        self->update_app_info();
-        g_variant_unref(v);
-      }
-  }
-
-  static void on_ccad_title(GObject      * source,
-                                      GAsyncResult * res,
-                                      gpointer       gself)
-  {
-    auto v = connection_call_finish(source, res, "Error getting Title property");
-    if (v != nullptr)
-      {
-        GVariant *value, *item;
-        item = g_variant_get_child_value(v, 0);
-        value = g_variant_get_variant(item);
-        g_variant_unref(item);
-
-        auto self = static_cast<DMTransfer*>(gself);
-        auto title = g_variant_get_string(value, nullptr);
-        g_debug("Download title: %s", title);
-        if (title && strlen(title))
-          self->set_title(title);
-        g_variant_unref(v);
       }
+    self->on_bootstrap_reply();
   }
 
   void call_ccad_method_no_args_no_response(const char* method_name)
@@ -559,7 +572,7 @@ private:
     const auto object_path = m_ccad_path.c_str();
     const auto interface_name = DM_DOWNLOAD_IFACE_NAME;
 
-    g_debug("%s transfer %s calling '%s' with '%s'", G_STRLOC, id.c_str(), method_name, object_path);
+    g_debug("%s transfer %s calling '%s' with '%s'", G_STRLOC, id.str().c_str(), method_name, object_path);
 
     g_dbus_connection_call(m_bus, bus_name, object_path, interface_name,
                            method_name, nullptr, nullptr,
@@ -569,81 +582,21 @@ private:
 
   void update_app_info()
   {
-    // destination app has priority over app_id
-    std::string app_id = download_app_id();
+    const auto& app_id = m_app_id;
 
-    if (!app_id.empty())
-      update_app_info_from_app_id(app_id);
-    else if (!m_package_name.empty())
-      update_app_info_from_package_name(m_package_name);
-    else
-      g_warning("Download without app-id or package-name");
-  }
-
-  void update_app_info_from_package_name(const std::string &package_name)
-  {
-    std::string app_id = std::string(ubuntu_app_launch_triplet_to_app_id(package_name.c_str(),
-                                                                         "first-listed-app",
-                                                                         "current-user-version"));
-    if (!app_id.empty())
-      update_app_info_from_app_id(app_id);
-    else
-      g_warning("fail to retrive app-id from package: %s", package_name.c_str());
-  }
-
-  void update_app_info_from_app_id(const std::string &app_id)
-  {
-    gchar *app_dir;
-    gchar *app_desktop_file;
-
-    if (!ubuntu_app_launch_application_info(app_id.c_str(), &app_dir, &app_desktop_file))
+    if (app_id.empty() && m_package_name.empty())
       {
-        g_warning("Fail to get app info: %s", app_id.c_str());
+        g_warning("Download without app-id or package-name");
         return;
       }
 
-    g_debug("App data: %s : %s", app_dir, app_desktop_file);
-    gchar *full_app_desktop_file = g_build_filename(app_dir, app_desktop_file, nullptr);
-    GKeyFile *app_info = g_key_file_new();
-    GError *error = nullptr;
-
-    g_debug("Open desktop file: %s", full_app_desktop_file);
-    g_key_file_load_from_file(app_info, full_app_desktop_file, G_KEY_FILE_NONE, &error);
-    if (error)
-      {
-        g_warning("Fail to open desktop info: %s:%s", full_app_desktop_file, error->message);
-        g_free(full_app_desktop_file);
-        g_key_file_free(app_info);
-        g_error_free(error);
-      }
-    else
-      {
-        gchar *icon_name = g_key_file_get_string(app_info, "Desktop Entry", "Icon", &error);
-        if (error == nullptr)
-          {
-
-            gchar *full_icon_name = g_build_filename(app_dir, icon_name, nullptr);
-            g_debug("App icon: %s", icon_name);
-            g_debug("App full icon name: %s", full_icon_name);
-            // check if it is full path icon or a themed one
-            if (g_file_test(full_icon_name, G_FILE_TEST_EXISTS))
-              set_icon(full_icon_name);
-            else
-              set_icon(icon_name);
-            g_free(full_icon_name);
-          }
-        else
-          {
-            g_warning("Fail to retrive icon:", error->message);
-            g_error_free(error);
-          }
-        g_free(icon_name);
-      }
-
-    g_key_file_free(app_info);
-    g_free(full_app_desktop_file);
-    g_free(app_dir);
-    g_free(app_desktop_file);
+    // resolving the icon touches the filesystem, so keep it off the main loop.
+    // m_cancellable is cancelled when we're destroyed, so capturing 'this' is safe
+    AppInfoCache::get_default().get_icon_async(app_id, m_package_name, m_cancellable,
+      [this](const std::string& icon){
+        if (!icon.empty())
+          set_icon(icon.c_str());
+      });
   }
 
   /***
@@ -652,7 +605,8 @@ private:
 
   static GVariant* connection_call_finish(GObject      * connection,
                                           GAsyncResult * res,
-                                          const char   * warning)
+                                          const char   * warning,
+                                          bool         * cancelled)
   {
     GError* error = nullptr;
 
@@ -662,7 +616,9 @@ private:
 
     if (v == nullptr)
       {
-        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+          *cancelled = true;
+        else
           g_warning("%s: %s", warning, error->message);
 
         g_error_free(error);
@@ -671,24 +627,16 @@ private:
     return v;
   }
 
-  core::Signal<> m_changed;
-
-  uint32_t m_changed_tag = 0;
+  ChangeScheduler* m_scheduler = nullptr;
+  int m_bootstrap_pending = 0;
+  Fields m_dirty_fields = 0; // changed since the last take_dirty_fields()
   uint64_t m_received = 0;
   uint64_t m_total_size = 0;
-  struct DownloadProgress {
-    int64_t time_usec; // microseconds since epoch
-    uint64_t bytes;
-    DownloadProgress operator-(const DownloadProgress& that) {
-      return DownloadProgress{time_usec-that.time_usec, bytes-that.bytes};
-    }
-  };
-  std::vector<DownloadProgress> m_history;
+  ThroughputEstimator m_estimator;
 
   GDBusConnection* m_bus = nullptr;
   GCancellable* m_cancellable = nullptr;
-  std::string m_app_id;
-  std::string m_destination_app;
+  std::string m_app_id; // the metadata's app-id, or else the DestinationApp
   std::string m_package_name;
   const std::string m_ccad_path;
 };
@@ -703,67 +651,213 @@ class DMSource::Impl
 {
 public:
 
+  static constexpr unsigned int DEFAULT_CHANGE_INTERVAL_MSEC {1000};
+  static constexpr size_t MAX_REMOVED_CCADS {1024};
+  // the limits that INDICATOR_TRANSFER_PRUNE_RETIRED opts into
+  static constexpr int PRUNE_MAX_RETIRED {50};
+  static constexpr int PRUNE_MAX_RETIRED_AGE_SEC {7*24*60*60};
+  static constexpr size_t PRUNE_MAX_MODEL_BYTES {4*1024*1024};
+  static constexpr unsigned int PRUNE_INTERVAL_SEC {60};
+  static constexpr unsigned int RESTORED_TIMEOUT_SEC {30};
+
+  // the fields that the journal keeps; progress and speed ticks aren't worth a write
+  static constexpr Transfer::Fields JOURNALED_FIELDS {Transfer::FIELD_STATE
+                                                    | Transfer::FIELD_CUSTOM_STATE
+                                                    | Transfer::FIELD_TITLE
+                                                    | Transfer::FIELD_APP_ICON
+                                                    | Transfer::FIELD_LOCAL_PATH
+                                                    | Transfer::FIELD_ERROR_STRING};
+
   Impl():
     m_cancellable(g_cancellable_new()),
-    m_model(std::make_shared<MutableModel>())
+    m_pool(std::make_shared<Pool>()),
+    m_model(std::make_shared<MutableModel>()),
+    m_scheduler(DEFAULT_CHANGE_INTERVAL_MSEC, [this](const std::vector<Transfer::Id>& ids){
+      m_model->begin_batch();
+      for (const auto& id : ids)
+        {
+          // transfers that haven't been admitted yet are added with all their fields
+          auto transfer = find_admitted_transfer(id);
+          if (!transfer)
+            continue;
+
+          // an urgent flush may have already taken a throttled change's fields
+          const auto fields = transfer->take_dirty_fields();
+          if (fields != 0)
+            m_model->emit_changed(id, fields);
+        }
+      m_model->end_batch();
+
+      // transfers retire by changing state, so this is when they overflow
+      prune_transfers();
+    }, m_pool),
+    m_ccad_to_transfer(0, CcadMap::hasher(), CcadMap::key_equal(), CcadMap::allocator_type(m_pool)),
+    m_id_to_transfer(0, IdMap::hasher(), IdMap::key_equal(), IdMap::allocator_type(m_pool)),
+    m_removed_ccad(MAX_REMOVED_CCADS)
   {
+    // retired transfers are kept until they're cleared unless we're asked
+    // to prune them, since pruning makes them vanish from the indicator
+    if (g_getenv("INDICATOR_TRANSFER_PRUNE_RETIRED") != nullptr)
+      {
+        MutableModel::RetentionPolicy policy;
+        policy.max_count = PRUNE_MAX_RETIRED;
+        policy.max_age_sec = PRUNE_MAX_RETIRED_AGE_SEC;
+        policy.max_bytes = PRUNE_MAX_MODEL_BYTES;
+        set_retention_policy(policy);
+      }
+
+    // populate the model before we go to the bus
+    open_journal();
+
     g_bus_get(G_BUS_TYPE_SESSION, m_cancellable, on_bus_ready, this);
   }
 
   ~Impl()
   {
+    if (m_prune_tag)
+      g_source_remove(m_prune_tag);
+    if (m_restored_tag)
+      g_source_remove(m_restored_tag);
+
     g_cancellable_cancel(m_cancellable);
     g_clear_object(&m_cancellable);
     set_bus(nullptr);
     g_clear_object(&m_bus);
+
+    for (auto& it : m_pending_creations)
+      unref_buffered_signals(it.second.signals);
+
+    // the views may still be holding our transfers
+    for (auto& it : m_ccad_to_transfer)
+      it.second->detach();
+
+    log_tombstone_stats();
+
+    const auto cache_stats = AppInfoCache::get_default().get_stats();
+    g_debug("app info cache: %llu hits, %llu misses, %llu invalidations, %zu entries",
+            (unsigned long long)cache_stats.hits,
+            (unsigned long long)cache_stats.misses,
+            (unsigned long long)cache_stats.invalidations,
+            cache_stats.n_entries);
+
+    for (int i=0; i<ChangeScheduler::NUM_LANES; ++i)
+      {
+        const auto lane = ChangeScheduler::Lane(i);
+        const auto& stats = m_scheduler.stats(lane);
+        g_debug("%s lane: %llu changes in %llu flushes, avg latency %.1f msec, max %.1f msec",
+                lane == ChangeScheduler::URGENT ? "urgent" : "throttled",
+                (unsigned long long)stats.n_changes,
+                (unsigned long long)stats.n_flushes,
+                stats.n_changes ? stats.total_latency_usec / 1000.0 / stats.n_changes : 0.0,
+                stats.max_latency_usec / 1000.0);
+      }
+
+    if (m_journal)
+      {
+        const auto journal_stats = m_journal->get_stats();
+        g_debug("journal: restored %zu, %llu puts (%llu unchanged), %llu removes, %llu compactions, %zu of %zu bytes live",
+                journal_stats.n_restored,
+                (unsigned long long)journal_stats.n_puts,
+                (unsigned long long)journal_stats.n_unchanged_puts,
+                (unsigned long long)journal_stats.n_removes,
+                (unsigned long long)journal_stats.n_compactions,
+                journal_stats.bytes_live,
+                journal_stats.bytes_used);
+      }
+
+    const auto& retention_stats = m_model->get_retention_stats();
+    g_debug("retention: %llu prunes, evicted %llu for age, %llu for count, %llu for memory",
+            (unsigned long long)retention_stats.n_prunes,
+            (unsigned long long)retention_stats.n_evicted_for_age,
+            (unsigned long long)retention_stats.n_evicted_for_count,
+            (unsigned long long)retention_stats.n_evicted_for_bytes);
+
+    const auto pool_stats = m_pool->get_stats();
+    g_debug("pool: %llu allocs, %llu reused, %llu large, %zu live (%zu bytes, peak %zu), %zu bytes reserved",
+            (unsigned long long)pool_stats.n_allocs,
+            (unsigned long long)pool_stats.n_reused,
+            (unsigned long long)pool_stats.n_large_allocs,
+            pool_stats.n_live,
+            pool_stats.bytes_live,
+            pool_stats.peak_bytes_live,
+            pool_stats.bytes_reserved);
+  }
+
+  void set_change_interval(unsigned int interval_msec)
+  {
+    m_scheduler.set_interval(interval_msec);
+  }
+
+  void set_retention_policy(const MutableModel::RetentionPolicy& policy)
+  {
+    m_model->set_retention_policy(policy);
+
+    // transfers age without changing, so a max age needs a timer
+    if (m_prune_tag)
+      {
+        g_source_remove(m_prune_tag);
+        m_prune_tag = 0;
+      }
+    if (policy.max_age_sec > 0)
+      m_prune_tag = g_timeout_add_seconds(PRUNE_INTERVAL_SEC, on_prune_timer, this);
+
+    prune_transfers();
+    forget_evicted(m_model->prune_expired());
   }
 
   void start(const Transfer::Id& id)
   {
     auto transfer = find_transfer_by_id(id);
-    g_return_if_fail(transfer);
-    transfer->start();
+    if (transfer)
+      transfer->start();
   }
 
   void pause(const Transfer::Id& id)
   {
     auto transfer = find_transfer_by_id(id);
-    g_return_if_fail(transfer);
-    transfer->pause();
+    if (transfer)
+      transfer->pause();
   }
 
   void resume(const Transfer::Id& id)
   {
     auto transfer = find_transfer_by_id(id);
-    g_return_if_fail(transfer);
-    transfer->resume();
+    if (transfer)
+      transfer->resume();
   }
 
   void cancel(const Transfer::Id& id)
   {
     auto transfer = find_transfer_by_id(id);
-    g_return_if_fail(transfer);
+    if (!transfer)
+      return;
+
     transfer->cancel();
 
     // remove transfer from the list if canceled
-    m_removed_ccad.insert(transfer->ccad_path());
-    m_model->remove(id);
+    remove_transfer(transfer);
   }
 
   void clear(const Transfer::Id& id)
   {
-    auto transfer = find_transfer_by_id(id);
-    if (transfer)
+    if (forget_restored(id))
       {
-        m_removed_ccad.insert(transfer->ccad_path());
-        m_model->remove(id);
+        if (m_model->count(id))
+          m_model->remove(id);
+        return;
       }
+
+    auto transfer = find_transfer_by_id(id);
+    if (transfer)
+      remove_transfer(transfer);
   }
 
   void open(const Transfer::Id& id)
   {
     auto transfer = find_transfer_by_id(id);
-    g_return_if_fail(transfer);
+    if (!transfer)
+      return;
+
     transfer->open();
     transfer->open_app();
   }
@@ -771,8 +865,8 @@ public:
   void open_app(const Transfer::Id& id)
   {
     auto transfer = find_transfer_by_id(id);
-    g_return_if_fail(transfer);
-    transfer->open_app();
+    if (transfer)
+      transfer->open_app();
   }
 
   std::shared_ptr<MutableModel> get_model()
@@ -811,6 +905,13 @@ private:
           g_dbus_connection_signal_unsubscribe(m_bus, tag);
 
         m_signal_subscriptions.clear();
+
+        if (m_dm_watch_tag)
+          {
+            g_bus_unwatch_name(m_dm_watch_tag);
+            m_dm_watch_tag = 0;
+          }
+
         g_clear_object(&m_bus);
       }
 
@@ -832,9 +933,136 @@ private:
                                                  this,
                                                  nullptr);
         m_signal_subscriptions.insert(tag);
+
+        // pick up DownloadManager's downloads whenever it's on the bus.
+        // its object paths die with it, so forget our tombstones when it leaves
+        m_dm_watch_tag = g_bus_watch_name_on_connection(bus,
+                                                        DM_BUS_NAME,
+                                                        G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                        on_dm_appeared,
+                                                        on_dm_vanished,
+                                                        this,
+                                                        nullptr);
     }
   }
 
+  static void on_dm_appeared(GDBusConnection* /*connection*/,
+                             const gchar*       name,
+                             const gchar*     /*name_owner*/,
+                             gpointer           gself)
+  {
+    g_debug("%s: %s", G_STRFUNC, name);
+    static_cast<Impl*>(gself)->enumerate_downloads();
+  }
+
+  static void on_dm_vanished(GDBusConnection* /*connection*/,
+                             const gchar*       name,
+                             gpointer           gself)
+  {
+    // this is also called at startup if DownloadManager isn't running yet.
+    // restored transfers are kept until it's running and has been enumerated,
+    // or until on_restored_timeout() gives up on it.
+    g_debug("%s: %s", G_STRFUNC, name);
+    auto self = static_cast<Impl*>(gself);
+    self->log_tombstone_stats();
+    self->m_removed_ccad.clear();
+  }
+
+  void log_tombstone_stats() const
+  {
+    const auto stats = m_removed_ccad.stats();
+    g_debug("removed ccads: %zu entries, ~%zu bytes, %llu evictions, %llu clears",
+            stats.n_entries,
+            stats.n_bytes,
+            (unsigned long long)stats.n_evictions,
+            (unsigned long long)stats.n_clears);
+  }
+
+  /***
+  ****  Startup Enumeration
+  ***/
+
+  void enumerate_downloads()
+  {
+    m_enumeration_begin_usec = g_get_monotonic_time();
+
+    // if DownloadManager has just left the bus there's nothing to find,
+    // so don't let this call activate it again
+    g_dbus_connection_call(m_bus, DM_BUS_NAME, DM_MANAGER_PATH, DM_MANAGER_IFACE_NAME,
+                           "getAllDownloads", nullptr, G_VARIANT_TYPE("(ao)"),
+                           G_DBUS_CALL_FLAGS_NO_AUTO_START, -1,
+                           m_cancellable, on_all_downloads, this);
+  }
+
+  static void on_all_downloads(GObject      * source,
+                               GAsyncResult * res,
+                               gpointer       gself)
+  {
+    GError* error = nullptr;
+    auto v = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (v == nullptr)
+      {
+        // if we were cancelled, the Impl is already gone
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+          {
+            // the restored transfers are kept until an enumeration succeeds or times out
+            if (g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN))
+              g_debug("DownloadManager isn't running; no downloads to enumerate");
+            else
+              g_warning("Error calling getAllDownloads(): %s", error->message);
+          }
+
+        g_error_free(error);
+        return;
+      }
+
+    auto self = static_cast<Impl*>(gself);
+    GVariantIter* iter = nullptr;
+    const gchar* ccad_path = nullptr;
+    g_variant_get(v, "(ao)", &iter);
+    while (g_variant_iter_next(iter, "&o", &ccad_path))
+      {
+        // skip the ones we already know about or are already creating
+        if (self->find_transfer_by_ccad_path(ccad_path) ||
+            self->m_pending_creations.count(ccad_path) ||
+            self->m_removed_ccad.contains(ccad_path))
+          continue;
+
+        self->m_pending_creations.emplace(ccad_path, PendingCreation{{}, true});
+        self->create_new_transfer(ccad_path);
+        ++self->m_enumeration_pending;
+      }
+    g_variant_iter_free(iter);
+    g_variant_unref(v);
+
+    if (self->m_enumeration_pending == 0)
+      self->finish_enumeration();
+  }
+
+  void finish_enumeration()
+  {
+    m_model->begin_batch();
+    for (const auto& transfer : m_enumerated)
+      admit_transfer(transfer);
+    m_model->end_batch();
+
+    const auto elapsed_usec = g_get_monotonic_time() - m_enumeration_begin_usec;
+    g_debug("%s: found %zu existing downloads in %.1f msec",
+            G_STRFUNC, m_enumerated.size(), elapsed_usec / 1000.0);
+
+    m_enumerated.clear();
+
+    // restored transfers that weren't found are gone
+    if (m_restored_tag)
+      {
+        g_source_remove(m_restored_tag);
+        m_restored_tag = 0;
+      }
+    drop_restored();
+
+    prune_transfers();
+  }
+
 
   static void on_download_signal(GDBusConnection* /*connection*/,
                                  const gchar*     /*sender_name*/,
@@ -849,12 +1077,34 @@ private:
     g_free(variant_str);
 
     // Route this signal to the DMTransfer for processing
-    auto self = static_cast<Impl*>(gself);
-    auto transfer = self->find_transfer_by_ccad_path(ccad_path);
+    static_cast<Impl*>(gself)->route_signal(ccad_path, signal_name, parameters);
+  }
+
+  void route_signal(const std::string& ccad_path,
+                    const gchar* signal_name,
+                    GVariant* parameters)
+  {
+    auto transfer = find_transfer_by_ccad_path(ccad_path);
     if (transfer)
-      transfer->handle_ccad_signal(signal_name, parameters);
-    else
-      self->create_new_transfer(ccad_path);
+      {
+        transfer->handle_ccad_signal(signal_name, parameters);
+        return;
+      }
+
+    // don't let transfers reappear after they've been cleared by the user
+    if (m_removed_ccad.contains(ccad_path))
+      return;
+
+    // if the transfer's still being created, hold the signal
+    // so that it can be replayed once the transfer's admitted
+    auto it = m_pending_creations.find(ccad_path);
+    if (it == m_pending_creations.end())
+      {
+        it = m_pending_creations.emplace(ccad_path, PendingCreation{{}, false}).first;
+        create_new_transfer(ccad_path);
+      }
+
+    it->second.signals.push_back(BufferedSignal{signal_name, g_variant_ref(parameters)});
   }
 
   /***
@@ -863,80 +1113,434 @@ private:
 
   std::shared_ptr<DMTransfer> find_transfer_by_ccad_path(const std::string& path)
   {
-    for (const auto& transfer : m_model->get_all())
+    auto it = m_ccad_to_transfer.find(path);
+    if (it != m_ccad_to_transfer.end())
+      return it->second;
+
+    return nullptr;
+  }
+
+  void index_transfer(const std::shared_ptr<DMTransfer>& transfer)
+  {
+    m_ccad_to_transfer[transfer->ccad_path()] = transfer;
+    m_id_to_transfer[transfer->id] = transfer;
+  }
+
+  void add_transfer(const std::shared_ptr<DMTransfer>& transfer)
+  {
+    index_transfer(transfer);
+    admit_transfer(transfer);
+  }
+
+  // adds the transfer, or swaps it in for the restored one whose id it adopted
+  void admit_transfer(const std::shared_ptr<DMTransfer>& transfer)
+  {
+    // the id stops being a restored one once the model has the real transfer
+    auto it = m_restored.find(transfer->id);
+    if (it != m_restored.end())
+      {
+        m_restored_by_ccad.erase(it->second);
+        m_restored.erase(it);
+      }
+
+    // the model gets all of its fields now
+    transfer->take_dirty_fields();
+
+    if (m_model->count(transfer->id))
+      m_model->update(transfer);
+    else
+      m_model->add(transfer);
+  }
+
+  void remove_transfer(const std::shared_ptr<DMTransfer>& transfer)
+  {
+    forget_transfer(transfer);
+    m_model->remove(transfer->id);
+  }
+
+  void forget_transfer(const std::shared_ptr<DMTransfer>& transfer)
+  {
+    // don't let transfers reappear after they've been cleared or evicted
+    m_removed_ccad.insert(transfer->ccad_path());
+    m_ccad_to_transfer.erase(transfer->ccad_path());
+    m_id_to_transfer.erase(transfer->id);
+    m_scheduler.unschedule(transfer->id);
+  }
+
+  /***
+  ****  Retention
+  ***/
+
+  // transfers age without changing, so only the timer checks their age
+  static gboolean on_prune_timer(gpointer gself)
+  {
+    auto self = static_cast<Impl*>(gself);
+    self->forget_evicted(self->m_model->prune_expired());
+    return G_SOURCE_CONTINUE;
+  }
+
+  void prune_transfers()
+  {
+    forget_evicted(m_model->prune());
+  }
+
+  void forget_evicted(const std::vector<std::shared_ptr<Transfer>>& evicted)
+  {
+    if (evicted.empty())
+      return;
+
+    // they're retired, so there's nothing left to hear from DownloadManager
+    for (const auto& transfer : evicted)
       {
-        const auto tmp = std::static_pointer_cast<DMTransfer>(transfer);
+        if (forget_restored(transfer->id))
+          continue;
+
+        auto dm_transfer = find_indexed_transfer(transfer->id);
+        if (!dm_transfer)
+          continue;
+        forget_transfer(dm_transfer);
+        dm_transfer->detach();
+      }
+
+    g_debug("%s: evicted %zu finished transfers; %d remain",
+            G_STRFUNC, evicted.size(), m_model->size());
+  }
 
-        if (tmp && (path == tmp->ccad_path()))
-          return tmp;
+  /***
+  ****  Journal
+  ***/
+
+  void open_journal()
+  {
+    // it's only worth keeping in a tmpfs that's private to the user
+    const auto runtime_dir = g_getenv("XDG_RUNTIME_DIR");
+    if ((runtime_dir == nullptr) || (g_getenv("INDICATOR_TRANSFER_NO_JOURNAL") != nullptr))
+      return;
+
+    auto dir = g_build_filename(runtime_dir, "indicator-transfer", nullptr);
+    auto filename = g_build_filename(dir, "dm-source.journal", nullptr);
+    g_mkdir_with_parents(dir, 0700);
+    m_journal.reset(new Journal(filename));
+    g_free(filename);
+    g_free(dir);
+
+    if (!m_journal->is_open())
+      {
+        m_journal.reset();
+        return;
       }
 
-    return nullptr;
+    // the restored transfers are placeholders until DownloadManager
+    // tells us about them again. their ids mustn't be handed out again.
+    const auto restored = m_journal->take_restored();
+    m_model->begin_batch();
+    for (const auto& entry : restored)
+      {
+        const auto& id = entry.transfer->id;
+        Transfer::reserve_unique_id(id);
+        m_restored.emplace(id, entry.key);
+        m_restored_by_ccad.emplace(entry.key, id);
+        m_model->add(std::make_shared<RestoredTransfer>(*entry.transfer));
+      }
+    m_model->end_batch();
+
+    // don't show them forever if DownloadManager never comes back to claim them
+    if (!m_restored.empty())
+      m_restored_tag = g_timeout_add_seconds(RESTORED_TIMEOUT_SEC, on_restored_timeout, this);
+
+    m_connections.insert(m_model->batch().connect([this](const Model::Changes& changes){
+      for (const auto& id : changes.removed)
+        m_journal->remove(id);
+      for (const auto& id : changes.added)
+        journal_transfer(id);
+      for (const auto& it : changes.changed)
+        if (it.second & JOURNALED_FIELDS)
+          journal_transfer(it.first);
+    }));
   }
 
-  void create_new_transfer(const std::string& ccad_path)
+  static gboolean on_restored_timeout(gpointer gself)
   {
-    // don't let transfers reappear after they've been cleared by the user
-    if (m_removed_ccad.count(ccad_path))
+    auto self = static_cast<Impl*>(gself);
+    g_debug("%s: DownloadManager hasn't been enumerated in %u seconds", G_STRFUNC, RESTORED_TIMEOUT_SEC);
+    self->m_restored_tag = 0;
+    self->drop_restored();
+    return G_SOURCE_REMOVE;
+  }
+
+  void journal_transfer(const Transfer::Id& id)
+  {
+    const auto transfer = m_model->get(id);
+    if (!transfer)
       return;
 
-    // check if the download should appear on indicator
-    GError *error = nullptr;
-    auto show = g_dbus_connection_call_sync(m_bus, DM_BUS_NAME, ccad_path.c_str(),
-                                            "org.freedesktop.DBus.Properties",
-                                            "Get", g_variant_new ("(ss)", DM_DOWNLOAD_IFACE_NAME, "ShowInIndicator"),
-                                            G_VARIANT_TYPE ("(v)"),
-                                            G_DBUS_CALL_FLAGS_NONE, -1,
-                                            m_cancellable, &error);
-    if (show != nullptr)
-      {
-        GVariant *value, *item;
-        item = g_variant_get_child_value(show, 0);
-        value = g_variant_get_variant(item);
-        bool show_in_idicator = g_variant_get_boolean(value);
-
-        g_variant_unref(value);
-        g_variant_unref(item);
-        g_variant_unref(show);
-
-        if (!show_in_idicator)
+    const auto restored = m_restored.find(id);
+    if (restored != m_restored.end())
+      {
+        m_journal->put(*transfer, restored->second);
+        return;
+      }
+
+    const auto dm_transfer = find_indexed_transfer(id);
+    if (dm_transfer)
+      m_journal->put(*transfer, dm_transfer->ccad_path());
+  }
+
+  /**
+   * If there's a restored transfer for this ccad, the new transfer
+   * takes over its id so that the views update it in place.
+   * The id stays in m_restored until admit_transfer() swaps the new
+   * transfer into the model; until then the model still has the
+   * placeholder, and actions on the id are ignored.
+   */
+  void adopt_restored_id(const std::shared_ptr<DMTransfer>& transfer)
+  {
+    auto it = m_restored_by_ccad.find(transfer->ccad_path());
+    if (it == m_restored_by_ccad.end())
+      return;
+
+    m_scheduler.unschedule(transfer->id);
+    transfer->id = it->second;
+    m_restored_by_ccad.erase(it);
+  }
+
+  // returns true if the id was a restored transfer's
+  bool forget_restored(const Transfer::Id& id)
+  {
+    auto it = m_restored.find(id);
+    if (it == m_restored.end())
+      return false;
+
+    // a transfer that adopted the id but hasn't been admitted goes too
+    auto adopter = find_indexed_transfer(id);
+    if (adopter)
+      {
+        forget_transfer(adopter);
+        adopter->detach();
+        m_enumerated.erase(std::remove(m_enumerated.begin(), m_enumerated.end(), adopter),
+                           m_enumerated.end());
+      }
+
+    m_removed_ccad.insert(it->second);
+    m_restored_by_ccad.erase(it->second);
+    m_restored.erase(it);
+    return true;
+  }
+
+  // removes the restored transfers that DownloadManager didn't know about
+  void drop_restored()
+  {
+    if (m_restored.empty())
+      return;
+
+    // take them out of the maps first so that the batch is journaled as removals,
+    // but keep the ones that are still being created or waiting to be admitted
+    std::vector<Transfer::Id> dropped;
+    for (auto it=m_restored.begin(); it!=m_restored.end(); )
+      {
+        if (m_pending_creations.count(it->second) || m_id_to_transfer.count(it->first))
           {
-            m_removed_ccad.insert(ccad_path);
-            return;
+            ++it;
+            continue;
           }
+
+        dropped.push_back(it->first);
+        m_restored_by_ccad.erase(it->second);
+        it = m_restored.erase(it);
+      }
+
+    g_debug("%s: dropping %zu restored transfers", G_STRFUNC, dropped.size());
+
+    m_model->begin_batch();
+    for (const auto& id : dropped)
+      if (m_model->count(id))
+        m_model->remove(id);
+    m_model->end_batch();
+  }
+
+  /***
+  ****  Transfer Creation
+  ***/
+
+  struct BufferedSignal
+  {
+    std::string name;
+    GVariant* parameters;
+  };
+
+  struct PendingCreation
+  {
+    // signals that arrived while the ccad's properties were being read
+    std::vector<BufferedSignal> signals;
+
+    // true if found by enumerate_downloads() rather than by a signal
+    bool enumerated;
+  };
+
+  struct CreationData
+  {
+    Impl* self;
+    std::string ccad_path;
+  };
+
+  static void unref_buffered_signals(std::vector<BufferedSignal>& signals)
+  {
+    for (auto& signal : signals)
+      g_variant_unref(signal.parameters);
+
+    signals.clear();
+  }
+
+  void create_new_transfer(const std::string& ccad_path)
+  {
+    // fetch all the ccad's properties in one round trip;
+    // ShowInIndicator tells us if the download should appear on indicator
+    g_dbus_connection_call(m_bus, DM_BUS_NAME, ccad_path.c_str(),
+                           "org.freedesktop.DBus.Properties",
+                           "GetAll", g_variant_new ("(s)", DM_DOWNLOAD_IFACE_NAME),
+                           G_VARIANT_TYPE ("(a{sv})"),
+                           G_DBUS_CALL_FLAGS_NONE, -1,
+                           m_cancellable, on_ccad_properties, new CreationData{this, ccad_path});
+  }
+
+  static void on_ccad_properties(GObject      * source,
+                                 GAsyncResult * res,
+                                 gpointer       gdata)
+  {
+    auto data = static_cast<CreationData*>(gdata);
+    GVariant* properties = nullptr;
+
+    GError* error = nullptr;
+    auto v = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (v != nullptr)
+      {
+        properties = g_variant_get_child_value(v, 0);
+        g_variant_unref(v);
       }
     else if (error != nullptr)
       {
-        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-          g_warning("Fail to retrieve 'ShowInIndicator' property: %s", error->message);
+        // if we were cancelled, the Impl is already gone
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+          {
+            g_error_free(error);
+            delete data;
+            return;
+          }
+
+        g_warning("Fail to retrieve properties of '%s': %s", data->ccad_path.c_str(), error->message);
         g_error_free(error);
       }
 
-    auto new_transfer = std::make_shared<DMTransfer>(m_bus, ccad_path);
+    data->self->finish_creation(data->ccad_path, properties);
+    g_clear_pointer(&properties, g_variant_unref);
+    delete data;
+  }
+
+  void finish_creation(const std::string& ccad_path, GVariant* properties)
+  {
+    auto it = m_pending_creations.find(ccad_path);
+    g_return_if_fail(it != m_pending_creations.end());
+    auto signals = std::move(it->second.signals);
+    const bool enumerated = it->second.enumerated;
+    m_pending_creations.erase(it);
+
+    gboolean show_in_indicator = true;
+    if (properties != nullptr)
+      g_variant_lookup(properties, "ShowInIndicator", "b", &show_in_indicator);
+
+    if (!show_in_indicator)
+      {
+        m_removed_ccad.insert(ccad_path);
+      }
+    else
+      {
+        auto new_transfer = std::allocate_shared<DMTransfer>(PoolAllocator<DMTransfer>(m_pool),
+                                                             m_bus, &m_scheduler, ccad_path, properties);
+        adopt_restored_id(new_transfer);
+
+        // enumerated transfers are held back so that
+        // they can be added to the model in a single pass
+        if (enumerated)
+          {
+            index_transfer(new_transfer);
+            m_enumerated.push_back(new_transfer);
+          }
+        else
+          {
+            add_transfer(new_transfer);
+          }
+
+        // replay the signals that arrived while we were waiting
+        for (const auto& signal : signals)
+          new_transfer->handle_ccad_signal(signal.name.c_str(), signal.parameters);
+      }
+
+    unref_buffered_signals(signals);
+
+    if (enumerated && (--m_enumeration_pending == 0))
+      finish_enumeration();
+  }
+
+  // one of our transfers, whether or not it's in the model yet
+  std::shared_ptr<DMTransfer> find_indexed_transfer(const Transfer::Id& id)
+  {
+    auto it = m_id_to_transfer.find(id);
+    if (it != m_id_to_transfer.end())
+      return it->second;
+
+    return nullptr;
+  }
 
-    m_model->add(new_transfer);
+  // one of our transfers, if it's the one that the model has for this id
+  std::shared_ptr<DMTransfer> find_admitted_transfer(const Transfer::Id& id)
+  {
+    auto transfer = find_indexed_transfer(id);
+    if (transfer && (m_model->get(id) == transfer))
+      return transfer;
 
-    // when one of the DMTransfer's properties changes,
-    // emit a change signal for the model
-    const auto id = new_transfer->id;
-    new_transfer->changed().connect([this,id]{
-      if (m_model->get(id))
-        m_model->emit_changed(id);
-    });
+    return nullptr;
   }
 
+  // for actions from the views
   std::shared_ptr<DMTransfer> find_transfer_by_id(const Transfer::Id& id)
   {
-    auto transfer = m_model->get(id);
-    g_return_val_if_fail(transfer, std::shared_ptr<DMTransfer>());
-    return std::static_pointer_cast<DMTransfer>(transfer);
+    auto transfer = find_admitted_transfer(id);
+    if (transfer)
+      return transfer;
+
+    // restored transfers can't do anything until DownloadManager has them again
+    g_return_val_if_fail(m_restored.count(id), nullptr);
+    g_debug("%s: ignoring an action on restored transfer %s", G_STRFUNC, id.str().c_str());
+    return nullptr;
   }
 
   GDBusConnection* m_bus = nullptr;
   GCancellable* m_cancellable = nullptr;
   std::set<guint> m_signal_subscriptions;
+  std::shared_ptr<Pool> m_pool; // transfers and their index nodes
   std::shared_ptr<MutableModel> m_model;
-  std::set<std::string> m_removed_ccad;
+  ChangeScheduler m_scheduler;
+  typedef std::unordered_map<std::string,std::shared_ptr<DMTransfer>,
+                             std::hash<std::string>, std::equal_to<std::string>,
+                             PoolAllocator<std::pair<const std::string,std::shared_ptr<DMTransfer>>>> CcadMap;
+  CcadMap m_ccad_to_transfer;
+  typedef std::unordered_map<Transfer::Id,std::shared_ptr<DMTransfer>,
+                             std::hash<Transfer::Id>, std::equal_to<Transfer::Id>,
+                             PoolAllocator<std::pair<const Transfer::Id,std::shared_ptr<DMTransfer>>>> IdMap;
+  IdMap m_id_to_transfer;
+  std::unordered_map<std::string,PendingCreation> m_pending_creations;
+  std::vector<std::shared_ptr<DMTransfer>> m_enumerated;
+  int m_enumeration_pending = 0;
+  gint64 m_enumeration_begin_usec = 0;
+  TombstoneSet m_removed_ccad;
+  guint m_dm_watch_tag = 0;
+  guint m_prune_tag = 0;
+  guint m_restored_tag = 0;
+
+  std::unique_ptr<Journal> m_journal;
+  std::unordered_map<Transfer::Id,std::string> m_restored; // id -> ccad path
+  std::unordered_map<std::string,Transfer::Id> m_restored_by_ccad;
+  std::set<core::ScopedConnection> m_connections;
 };
 
 /***
@@ -994,6 +1598,18 @@ DMSource::open_app(const Transfer::Id& id)
     impl->open_app(id);
 }
 
+void
+DMSource::set_change_interval(unsigned int interval_msec)
+{
+  impl->set_change_interval(interval_msec);
+}
+
+void
+DMSource::set_retention_policy(const MutableModel::RetentionPolicy& policy)
+{
+  impl->set_retention_policy(policy);
+}
+
 const std::shared_ptr<const MutableModel>
 DMSource::get_model()
 {
@@ -0,0 +1,452 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "journal.h"
+
+#include <glib/gstdio.h>
+
+#include <fcntl.h> // open()
+#include <sys/mman.h> // mmap()
+#include <sys/stat.h> // fstat()
+#include <unistd.h> // ftruncate()
+
+#include <algorithm> // std::max()
+#include <cerrno>
+#include <cstring> // memcpy(), strerror()
+
+namespace unity {
+namespace indicator {
+namespace transfer {
+
+namespace {
+
+// the file starts with MAGIC and then the offset where the next record goes
+static constexpr char MAGIC[8] {'I','T','J','R','N','L','0','1'};
+static constexpr size_t HEADER_SIZE {sizeof(MAGIC) + sizeof(uint64_t)};
+
+// each record is a uint32_t payload size, a RecordType, and the payload
+static constexpr size_t RECORD_HEADER_SIZE {sizeof(uint32_t) + sizeof(uint8_t)};
+
+static constexpr size_t MIN_FILE_SIZE {64*1024};
+
+// compact when the file's this big and mostly stale
+static constexpr size_t MIN_COMPACT_BYTES {256*1024};
+static constexpr size_t STALE_FACTOR {4};
+
+class Encoder
+{
+public:
+  template<typename T> void put(T value)
+  {
+    m_buf.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  void put(const std::string& str)
+  {
+    put(uint32_t(str.size()));
+    m_buf.append(str);
+  }
+
+  std::string& str() {return m_buf;}
+
+private:
+  std::string m_buf;
+};
+
+class Decoder
+{
+public:
+  explicit Decoder(const std::string& buf): m_pos(buf.data()), m_end(buf.data()+buf.size()) {}
+
+  template<typename T> bool get(T& setme)
+  {
+    if (size_t(m_end - m_pos) < sizeof(T))
+      return false;
+    memcpy(&setme, m_pos, sizeof(T));
+    m_pos += sizeof(T);
+    return true;
+  }
+
+  bool get(std::string& setme)
+  {
+    uint32_t len = 0;
+    if (!get(len) || (size_t(m_end - m_pos) < len))
+      return false;
+    setme.assign(m_pos, len);
+    m_pos += len;
+    return true;
+  }
+
+private:
+  const char* m_pos;
+  const char* const m_end;
+};
+
+} // anonymous namespace
+
+/***
+****
+***/
+
+Journal::Journal(const std::string& filename):
+  m_filename(filename)
+{
+  if (open_file())
+    replay();
+}
+
+Journal::~Journal()
+{
+  if (m_compact_tag)
+    g_source_remove(m_compact_tag);
+
+  close_file();
+}
+
+bool Journal::is_open() const
+{
+  return m_map != nullptr;
+}
+
+std::vector<Journal::Entry> Journal::take_restored()
+{
+  std::vector<Entry> restored;
+  restored.swap(m_restored);
+  return restored;
+}
+
+Journal::Stats Journal::get_stats() const
+{
+  auto stats = m_stats;
+  stats.n_live = m_live.size();
+  stats.bytes_live = m_live_bytes;
+  stats.bytes_used = is_open() ? get_end() : 0;
+  stats.bytes_mapped = m_map_size;
+  return stats;
+}
+
+/***
+****  File
+***/
+
+bool Journal::open_file()
+{
+  m_fd = open(m_filename.c_str(), O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+  if (m_fd == -1)
+    {
+      g_warning("Unable to open journal '%s': %s", m_filename.c_str(), g_strerror(errno));
+      return false;
+    }
+
+  struct stat st;
+  if ((fstat(m_fd, &st) == -1) || !grow(std::max(size_t(st.st_size), MIN_FILE_SIZE)))
+    {
+      close_file();
+      return false;
+    }
+
+  // start over if it's not a journal we can read
+  const auto end = get_end();
+  if (memcmp(m_map, MAGIC, sizeof(MAGIC)) || (end < HEADER_SIZE) || (end > m_map_size))
+    {
+      if (st.st_size != 0)
+        g_warning("Discarding unreadable journal '%s'", m_filename.c_str());
+      memcpy(m_map, MAGIC, sizeof(MAGIC));
+      set_end(HEADER_SIZE);
+    }
+
+  return true;
+}
+
+void Journal::close_file()
+{
+  if (m_map != nullptr)
+    {
+      munmap(m_map, m_map_size);
+      m_map = nullptr;
+      m_map_size = 0;
+    }
+
+  if (m_fd != -1)
+    {
+      close(m_fd);
+      m_fd = -1;
+    }
+}
+
+/**
+ * Makes the file, and the mapping, at least n_bytes long.
+ */
+bool Journal::grow(size_t n_bytes)
+{
+  if (n_bytes <= m_map_size)
+    return true;
+
+  struct stat st;
+  if ((fstat(m_fd, &st) == 0) && (size_t(st.st_size) < n_bytes) && (ftruncate(m_fd, n_bytes) == -1))
+    {
+      g_warning("Unable to grow journal '%s': %s", m_filename.c_str(), g_strerror(errno));
+      return false;
+    }
+
+  if (m_map != nullptr)
+    munmap(m_map, m_map_size);
+  m_map_size = 0;
+
+  auto map = mmap(nullptr, n_bytes, PROT_READ|PROT_WRITE, MAP_SHARED, m_fd, 0);
+  if (map == MAP_FAILED)
+    {
+      g_warning("Unable to map journal '%s': %s", m_filename.c_str(), g_strerror(errno));
+      m_map = nullptr;
+      return false;
+    }
+
+  m_map = static_cast<char*>(map);
+  m_map_size = n_bytes;
+  return true;
+}
+
+size_t Journal::get_end() const
+{
+  uint64_t end;
+  memcpy(&end, m_map + sizeof(MAGIC), sizeof(end));
+  return end;
+}
+
+void Journal::set_end(size_t end)
+{
+  const uint64_t tmp = end;
+  memcpy(m_map + sizeof(MAGIC), &tmp, sizeof(tmp));
+}
+
+/***
+****  Records
+***/
+
+void Journal::replay()
+{
+  const auto end = get_end();
+  size_t pos = HEADER_SIZE;
+  while (pos + RECORD_HEADER_SIZE <= end)
+    {
+      uint32_t size;
+      uint8_t type;
+      memcpy(&size, m_map + pos, sizeof(size));
+      memcpy(&type, m_map + pos + sizeof(size), sizeof(type));
+      pos += RECORD_HEADER_SIZE;
+      if (pos + size > end)
+        break;
+
+      std::string payload(m_map + pos, size);
+      pos += size;
+
+      // a PUT's payload starts with the id, and a REMOVE's is only the id
+      std::string id_str;
+      if (!Decoder(payload).get(id_str))
+        continue;
+      const Transfer::Id id {id_str};
+
+      auto it = m_live.find(id);
+      if (it != m_live.end())
+        {
+          m_live_bytes -= RECORD_HEADER_SIZE + it->second.size();
+          m_live.erase(it);
+        }
+      if (type == PUT)
+        {
+          m_live_bytes += RECORD_HEADER_SIZE + payload.size();
+          m_live.emplace(id, std::move(payload));
+        }
+    }
+
+  for (const auto& it : m_live)
+    {
+      Entry entry;
+      if (decode(it.second, entry))
+        m_restored.push_back(std::move(entry));
+    }
+  m_stats.n_restored = m_restored.size();
+
+  g_debug("%s: restored %zu transfers from %zu bytes of '%s'",
+          G_STRFUNC, m_restored.size(), end, m_filename.c_str());
+}
+
+void Journal::append(RecordType type, const std::string& payload)
+{
+  if (!is_open())
+    return;
+
+  const auto end = get_end();
+  const auto new_end = end + RECORD_HEADER_SIZE + payload.size();
+  if ((new_end > m_map_size) && !grow(std::max(m_map_size*2, new_end)))
+    {
+      close_file();
+      return;
+    }
+
+  // write the record before publishing it, so a crash can't leave half of one
+  const uint32_t size = payload.size();
+  memcpy(m_map + end, &size, sizeof(size));
+  memcpy(m_map + end + sizeof(size), &type, sizeof(type));
+  memcpy(m_map + end + RECORD_HEADER_SIZE, payload.data(), payload.size());
+  set_end(new_end);
+
+  if (!m_compact_tag && (new_end > MIN_COMPACT_BYTES) && (new_end > STALE_FACTOR*(HEADER_SIZE + m_live_bytes)))
+    m_compact_tag = g_idle_add_full(G_PRIORITY_LOW, on_compact_idle, this, nullptr);
+}
+
+void Journal::put(const Transfer& transfer, const std::string& key)
+{
+  auto payload = encode(transfer, key);
+
+  auto& live = m_live[transfer.id];
+  if (live == payload)
+    {
+      ++m_stats.n_unchanged_puts;
+      return;
+    }
+
+  ++m_stats.n_puts;
+  append(PUT, payload);
+  m_live_bytes -= live.empty() ? 0 : RECORD_HEADER_SIZE + live.size();
+  m_live_bytes += RECORD_HEADER_SIZE + payload.size();
+  live.swap(payload);
+}
+
+void Journal::remove(const Transfer::Id& id)
+{
+  auto it = m_live.find(id);
+  if (it == m_live.end())
+    return;
+
+  ++m_stats.n_removes;
+  m_live_bytes -= RECORD_HEADER_SIZE + it->second.size();
+  m_live.erase(it);
+
+  Encoder encoder;
+  encoder.put(id.str());
+  append(REMOVE, encoder.str());
+}
+
+gboolean Journal::on_compact_idle(gpointer gself)
+{
+  auto self = static_cast<Journal*>(gself);
+  self->m_compact_tag = 0;
+  self->compact();
+  return G_SOURCE_REMOVE;
+}
+
+void Journal::compact()
+{
+  if (!is_open())
+    return;
+
+  const size_t old_end = get_end();
+
+  std::string contents(MAGIC, sizeof(MAGIC));
+  contents.reserve(HEADER_SIZE + m_live_bytes);
+  const uint64_t end = HEADER_SIZE + m_live_bytes;
+  contents.append(reinterpret_cast<const char*>(&end), sizeof(end));
+  for (const auto& it : m_live)
+    {
+      const uint32_t size = it.second.size();
+      const uint8_t type = PUT;
+      contents.append(reinterpret_cast<const char*>(&size), sizeof(size));
+      contents.append(reinterpret_cast<const char*>(&type), sizeof(type));
+      contents.append(it.second);
+    }
+
+  // g_file_set_contents() replaces the file atomically
+  GError* error = nullptr;
+  close_file();
+  if (!g_file_set_contents(m_filename.c_str(), contents.data(), contents.size(), &error))
+    {
+      g_warning("Unable to compact journal '%s': %s", m_filename.c_str(), error->message);
+      g_error_free(error);
+      return;
+    }
+  if (!open_file())
+    return;
+
+  ++m_stats.n_compactions;
+  g_debug("%s: compacted '%s' from %zu bytes to %zu",
+          G_STRFUNC, m_filename.c_str(), old_end, contents.size());
+}
+
+/***
+****  Encoding
+***/
+
+std::string Journal::encode(const Transfer& t, const std::string& key)
+{
+  Encoder encoder;
+  encoder.put(t.id.str());
+  encoder.put(key);
+  encoder.put(uint8_t(t.state));
+  encoder.put(int32_t(t.seconds_left));
+  encoder.put(int64_t(t.time_started));
+  encoder.put(t.progress);
+  encoder.put(t.speed_Bps);
+  encoder.put(t.total_size);
+  encoder.put(t.title);
+  encoder.put(t.app_icon);
+  encoder.put(t.custom_state());
+  encoder.put(t.error_string());
+  encoder.put(t.local_path());
+  return std::move(encoder.str());
+}
+
+bool Journal::decode(const std::string& payload, Entry& setme)
+{
+  Decoder decoder(payload);
+  auto t = std::make_shared<Transfer>();
+
+  std::string id;
+  uint8_t state;
+  int32_t seconds_left;
+  int64_t time_started;
+  std::string custom_state, error_string, local_path;
+  const bool ok = decoder.get(id)
+               && decoder.get(setme.key)
+               && decoder.get(state)
+               && decoder.get(seconds_left)
+               && decoder.get(time_started)
+               && decoder.get(t->progress)
+               && decoder.get(t->speed_Bps)
+               && decoder.get(t->total_size)
+               && decoder.get(t->title)
+               && decoder.get(t->app_icon)
+               && decoder.get(custom_state)
+               && decoder.get(error_string)
+               && decoder.get(local_path)
+               && (state <= Transfer::ERROR);
+  if (!ok)
+    return false;
+
+  t->id = Transfer::Id(id);
+  t->state = Transfer::State(state);
+  t->seconds_left = seconds_left;
+  t->time_started = time_t(time_started);
+  t->set_custom_state(custom_state);
+  t->set_error_string(error_string);
+  t->set_local_path(local_path);
+  setme.transfer = t;
+  return true;
+}
+
+} // namespace transfer
+} // namespace indicator
+} // namespace unity
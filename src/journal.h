@@ -0,0 +1,128 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDICATOR_TRANSFER_JOURNAL_H
+#define INDICATOR_TRANSFER_JOURNAL_H
+
+#include <transfer/transfer.h>
+
+#include <glib.h> // guint, gpointer
+
+#include <cstdint>
+#include <memory> // std::shared_ptr
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace unity {
+namespace indicator {
+namespace transfer {
+
+/**
+ * \brief An append-only log of a source's transfers, for warm restarts
+ *
+ * A source writes each transfer it adds or changes, and the id of each
+ * transfer it removes. The next time the service starts, the source can
+ * rebuild its model from the journal before the bus is acquired, and then
+ * reconcile that against what it finds on the bus.
+ *
+ * Records are appended to a memory-mapped file, so a write is a memcpy
+ * and a crash loses nothing that was written. Each transfer is stored
+ * with a key that the source can use to recognize it again, since ids
+ * aren't meaningful across restarts. When most of the file is stale
+ * records, it's rewritten from a low-priority idle with just the live ones.
+ *
+ * It's meant to live in $XDG_RUNTIME_DIR, which is private to the user
+ * and cleared at logout, so the file's byte order is the host's.
+ */
+class Journal
+{
+public:
+
+    struct Entry
+    {
+        std::shared_ptr<Transfer> transfer;
+        std::string key;
+    };
+
+    struct Stats
+    {
+        uint64_t n_puts = 0;
+        uint64_t n_unchanged_puts = 0; // skipped because nothing had changed
+        uint64_t n_removes = 0;
+        uint64_t n_compactions = 0;
+        size_t n_restored = 0;
+        size_t n_live = 0;
+        size_t bytes_used = 0;
+        size_t bytes_live = 0;
+        size_t bytes_mapped = 0;
+    };
+
+    // opens the journal, creating it if needed, and reads its transfers
+    explicit Journal(const std::string& filename);
+    ~Journal();
+
+    bool is_open() const;
+
+    // the transfers that were in the journal when it was opened.
+    // they're only returned once.
+    std::vector<Entry> take_restored();
+
+    void put(const Transfer& transfer, const std::string& key);
+    void remove(const Transfer::Id& id);
+
+    // rewrites the journal with only the live records
+    void compact();
+
+    Stats get_stats() const;
+
+private:
+
+    enum RecordType : uint8_t { PUT=1, REMOVE=2 };
+
+    bool open_file();
+    void close_file();
+    bool grow(size_t n_bytes);
+    void replay();
+    void append(RecordType type, const std::string& payload);
+    size_t get_end() const;
+    void set_end(size_t end);
+    static std::string encode(const Transfer& transfer, const std::string& key);
+    static bool decode(const std::string& payload, Entry& setme);
+    static gboolean on_compact_idle(gpointer gself);
+
+    const std::string m_filename;
+    int m_fd = -1;
+    char* m_map = nullptr;
+    size_t m_map_size = 0;
+
+    // the latest PUT payload for each transfer that hasn't been removed
+    std::unordered_map<Transfer::Id,std::string> m_live;
+    size_t m_live_bytes = 0;
+
+    std::vector<Entry> m_restored;
+    guint m_compact_tag = 0;
+    Stats m_stats;
+
+    Journal(const Journal&) =delete;
+    Journal& operator=(const Journal&) =delete;
+};
+
+} // namespace transfer
+} // namespace indicator
+} // namespace unity
+
+#endif // INDICATOR_TRANSFER_JOURNAL_H
@@ -19,20 +19,36 @@
 
 #include <transfer/model.h>
 
+#include <algorithm> // std::any_of(), std::copy_n(), std::min(), std::max(), std::sort(), std::upper_bound()
+#include <functional> // std::hash
+
 namespace unity {
 namespace indicator {
 namespace transfer {
 
+constexpr Model::Handle Model::INVALID_HANDLE;
+constexpr size_t Model::MAX_REMOVALS;
+constexpr uint8_t Model::Columns::FREE_SLOT;
+constexpr size_t Model::Snapshot::FANOUT;
+
 Model::~Model()
 {
+  std::lock_guard<std::mutex> lock(m_snapshot_idle_mutex);
+  if (m_snapshot_idle != nullptr)
+    {
+      g_source_destroy(m_snapshot_idle);
+      g_source_unref(m_snapshot_idle);
+    }
+  g_main_context_unref(m_context);
 }
 
 std::set<Transfer::Id> Model::get_ids() const
 {
   std::set<Transfer::Id> keys;
 
-  for(const auto& it : m_transfers)
-    keys.insert(it.first);
+  for(const auto& slot : m_slots)
+    if (slot.transfer)
+      keys.insert(slot.transfer->id);
 
   return keys;
 }
@@ -40,32 +56,623 @@ std::set<Transfer::Id> Model::get_ids() const
 std::vector<std::shared_ptr<Transfer>> Model::get_all() const
 {
   std::vector<std::shared_ptr<Transfer>> transfers;
+  transfers.reserve(m_size);
 
-  for(const auto& it : m_transfers)
-    transfers.push_back(it.second);
+  for(const auto& slot : m_slots)
+    if (slot.transfer)
+      transfers.push_back(slot.transfer);
 
   return transfers;
 }
 
 std::shared_ptr<Transfer> Model::get(const Transfer::Id& id) const
+{
+  return get_by_handle(get_handle(id));
+}
+
+int Model::size() const
+{
+    return m_size;
+}
+
+int Model::count(const Transfer::Id& id) const
+{
+    return get_handle(id) != INVALID_HANDLE ? 1 : 0;
+}
+
+Model::Handle Model::get_handle(const Transfer::Id& id) const
+{
+  if (m_index.empty())
+    return INVALID_HANDLE;
+
+  return m_index[find_bucket(id, std::hash<Transfer::Id>()(id))];
+}
+
+std::shared_ptr<Transfer> Model::get_by_handle(Handle handle) const
 {
   std::shared_ptr<Transfer> ret;
 
-  auto it = m_transfers.find(id);
-  if (it != m_transfers.end())
-    ret = it->second;
+  if (handle < m_slots.size())
+    ret = m_slots[handle].transfer;
 
   return ret;
 }
 
-int Model::size() const
+Model::Generation Model::generation() const
 {
-    return m_transfers.size();
+  return m_generation;
 }
 
-int Model::count(const Transfer::Id& id) const
+Model::Generation Model::get_generation(const Transfer::Id& id) const
+{
+  const auto handle = get_handle(id);
+  return handle != INVALID_HANDLE ? m_slots[handle].modified : 0;
+}
+
+bool Model::changes_since(Generation since, Changes& setme) const
+{
+  if ((since < m_removals_horizon) || (since > m_generation))
+    return false;
+
+  setme = Changes();
+
+  // m_removals is sorted by generation, so skip the ones we've already seen
+  auto it = std::upper_bound(m_removals.begin(), m_removals.end(), since,
+                             [](Generation g, const Removal& r){return g < r.generation;});
+  for (; it!=m_removals.end(); ++it)
+    if (it->added <= since) // if it came and went since then, it's a no-op
+      setme.removed.insert(it->id);
+
+  for (const auto& slot : m_slots)
+    {
+      if (!slot.transfer)
+        continue;
+
+      if (slot.added > since)
+        setme.added.insert(slot.transfer->id);
+      else if (slot.modified > since)
+        setme.changed[slot.transfer->id] = Transfer::ALL_FIELDS;
+    }
+
+  return true;
+}
+
+const Model::Totals& Model::get_totals() const
+{
+  return m_totals;
+}
+
+int Model::Totals::seconds_left() const
+{
+  if ((remaining == 0) || (speed_Bps == 0))
+    return -1;
+
+  return int(remaining / speed_Bps);
+}
+
+namespace
+{
+  bool is_unfinished(Transfer::State state)
+  {
+    return (state != Transfer::FINISHED)
+        && (state != Transfer::CANCELED)
+        && (state != Transfer::ERROR);
+  }
+
+  uint64_t get_received(float progress, uint64_t total_size)
+  {
+    return uint64_t(std::min(std::max(progress, 0.0f), 1.0f) * total_size);
+  }
+}
+
+const Model::Columns& Model::get_columns() const
+{
+  return m_columns;
+}
+
+int Model::count_in_states(StateMask mask) const
+{
+  // branchless so that the compiler can vectorize it
+  const auto* state = m_columns.state.data();
+  int n = 0;
+  for (size_t i=0, n_slots=m_columns.state.size(); i<n_slots; ++i)
+    n += (mask >> state[i]) & 1;
+  return n;
+}
+
+bool Model::any_in_states(StateMask mask) const
+{
+  return std::any_of(m_columns.state.begin(), m_columns.state.end(),
+                     [mask](uint8_t state){return (mask >> state) & 1;});
+}
+
+std::array<int,Transfer::ERROR+1> Model::count_by_state() const
+{
+  // one bin per possible value so that free slots needn't be skipped
+  std::array<int,Columns::FREE_SLOT+1> bins {};
+  for (const auto state : m_columns.state)
+    ++bins[state];
+
+  std::array<int,Transfer::ERROR+1> counts;
+  std::copy_n(bins.begin(), counts.size(), counts.begin());
+  return counts;
+}
+
+uint64_t Model::sum_speed() const
+{
+  const auto* speed = m_columns.speed_Bps.data();
+  uint64_t sum = 0;
+  for (size_t i=0, n_slots=m_columns.speed_Bps.size(); i<n_slots; ++i)
+    sum += speed[i];
+  return sum;
+}
+
+void Model::add_slot()
 {
-    return m_transfers.count(id);
+  m_slots.emplace_back();
+  m_columns.state.push_back(Columns::FREE_SLOT);
+  m_columns.progress.push_back(0);
+  m_columns.seconds_left.push_back(0);
+  m_columns.speed_Bps.push_back(0);
+  m_columns.total_size.push_back(0);
+}
+
+/**
+ * Copies the transfer's hot fields into the columns and adds them to the
+ * totals. The columns remember what was added so that remove_from_totals()
+ * can take it back out even if the transfer has since changed.
+ */
+void Model::add_to_totals(Handle handle)
+{
+  const auto& t = *m_slots[handle].transfer;
+  auto& c = m_columns;
+  c.state[handle] = t.state;
+  c.progress[handle] = t.progress;
+  c.seconds_left[handle] = t.seconds_left;
+  c.speed_Bps[handle] = t.speed_Bps;
+  c.total_size[handle] = t.total_size;
+
+  // the only per-transfer memory estimate is taken here, so a prune never has to
+  m_slots[handle].n_bytes = sizeof(Slot) + t.memory_usage();
+  m_n_bytes += m_slots[handle].n_bytes;
+
+  // and so do the slots, for the answers to the can_*() virtuals
+  auto& can = m_slots[handle].can;
+  can = (t.can_pause() ? CAN_PAUSE : 0)
+      | (t.can_resume() ? CAN_RESUME : 0)
+      | (t.can_clear() ? CAN_CLEAR : 0);
+  m_totals.n_can_pause[t.state] += !!(can & CAN_PAUSE);
+  m_totals.n_can_resume[t.state] += !!(can & CAN_RESUME);
+  m_totals.n_can_clear[t.state] += !!(can & CAN_CLEAR);
+
+  const auto received = get_received(t.progress, t.total_size);
+  ++m_totals.n_in_state[t.state];
+  m_totals.total_size += t.total_size;
+  m_totals.received += received;
+  m_totals.speed_Bps += t.speed_Bps;
+  if (is_unfinished(t.state))
+    m_totals.remaining += t.total_size - received;
+}
+
+void Model::remove_from_totals(Handle handle)
+{
+  auto& c = m_columns;
+  const auto state = Transfer::State(c.state[handle]);
+  const auto received = get_received(c.progress[handle], c.total_size[handle]);
+
+  m_n_bytes -= m_slots[handle].n_bytes;
+  m_slots[handle].n_bytes = 0;
+
+  auto& can = m_slots[handle].can;
+  m_totals.n_can_pause[state] -= !!(can & CAN_PAUSE);
+  m_totals.n_can_resume[state] -= !!(can & CAN_RESUME);
+  m_totals.n_can_clear[state] -= !!(can & CAN_CLEAR);
+  can = 0;
+
+  --m_totals.n_in_state[state];
+  m_totals.total_size -= c.total_size[handle];
+  m_totals.received -= received;
+  m_totals.speed_Bps -= c.speed_Bps[handle];
+  if (is_unfinished(state))
+    m_totals.remaining -= c.total_size[handle] - received;
+
+  c.state[handle] = Columns::FREE_SLOT;
+  c.progress[handle] = 0;
+  c.seconds_left[handle] = 0;
+  c.speed_Bps[handle] = 0;
+  c.total_size[handle] = 0;
+}
+
+void Model::log_removal(const Slot& slot, Generation generation)
+{
+  m_removals.push_back(Removal{generation, slot.added, slot.transfer->id});
+
+  if (m_removals.size() > MAX_REMOVALS)
+    {
+      m_removals_horizon = m_removals.front().generation;
+      m_removals.pop_front();
+    }
+}
+
+/**
+ * Returns the bucket holding the id's handle,
+ * or the empty bucket where it would be inserted.
+ */
+size_t Model::find_bucket(const Transfer::Id& id, size_t hash) const
+{
+  const size_t mask = m_index.size() - 1;
+
+  for (size_t i=hash & mask; ; i=(i+1) & mask)
+    {
+      const auto handle = m_index[i];
+      if (handle == INVALID_HANDLE)
+        return i;
+
+      const auto& slot = m_slots[handle];
+      if ((slot.hash == hash) && (slot.transfer->id == id))
+        return i;
+    }
+}
+
+void Model::rehash(size_t n_buckets)
+{
+  m_index.assign(n_buckets, INVALID_HANDLE);
+
+  const size_t mask = n_buckets - 1;
+  for (Handle handle=0, n=m_slots.size(); handle<n; ++handle)
+    {
+      if (!m_slots[handle].transfer)
+        continue;
+
+      auto i = m_slots[handle].hash & mask;
+      while (m_index[i] != INVALID_HANDLE)
+        i = (i+1) & mask;
+      m_index[i] = handle;
+    }
+}
+
+/**
+ * Adds a transfer to the slab and the index, or replaces
+ * the transfer that has the same id. Returns its handle.
+ */
+Model::Handle Model::insert(const std::shared_ptr<Transfer>& transfer)
+{
+  static constexpr size_t min_buckets {16};
+  if (size_t(m_size+1)*2 > m_index.size())
+    rehash(std::max(min_buckets, m_index.size()*2));
+
+  const auto hash = std::hash<Transfer::Id>()(transfer->id);
+  const auto bucket = find_bucket(transfer->id, hash);
+  auto handle = m_index[bucket];
+  const auto generation = ++m_generation;
+
+  if (handle == INVALID_HANDLE)
+    {
+      if (!m_free_slots.empty() && !m_walk_depth)
+        {
+          handle = m_free_slots.back();
+          m_free_slots.pop_back();
+        }
+      else
+        {
+          handle = m_slots.size();
+          add_slot();
+        }
+
+      m_index[bucket] = handle;
+      m_index_unpublished = true;
+      ++m_size;
+    }
+  else
+    {
+      // replacing a transfer counts as removing it
+      log_removal(m_slots[handle], generation);
+      remove_from_totals(handle);
+    }
+
+  auto& slot = m_slots[handle];
+  // a for_each() visitor may be holding the one being replaced
+  if (m_walk_depth && slot.transfer)
+    m_walk_graveyard.push_back(std::move(slot.transfer));
+  slot.transfer = transfer;
+  slot.hash = hash;
+  slot.added = slot.modified = generation;
+  set_retired_usec(handle, is_unfinished(transfer->state) ? 0 : g_get_monotonic_time());
+  add_to_totals(handle);
+  mark_unpublished(handle);
+  return handle;
+}
+
+/**
+ * Removes a transfer from the slab and the index.
+ * Uses backward-shift deletion so that no tombstones are left behind
+ * in the index and lookups never have to probe past deleted entries.
+ */
+void Model::erase(Handle handle)
+{
+  g_return_if_fail(handle < m_slots.size());
+  auto& slot = m_slots[handle];
+  g_return_if_fail(slot.transfer);
+
+  const size_t mask = m_index.size() - 1;
+  auto i = slot.hash & mask;
+  while (m_index[i] != handle)
+    i = (i+1) & mask;
+
+  for (auto j=(i+1) & mask; m_index[j]!=INVALID_HANDLE; j=(j+1) & mask)
+    {
+      // the bucket where m_index[j] would be if there were no collisions
+      const auto home = m_slots[m_index[j]].hash & mask;
+
+      // if home isn't cyclically in (i..j], then m_index[j] can move up to i
+      const bool stays = (i <= j) ? ((i < home) && (home <= j))
+                                  : ((i < home) || (home <= j));
+      if (!stays)
+        {
+          m_index[i] = m_index[j];
+          i = j;
+        }
+    }
+  m_index[i] = INVALID_HANDLE;
+  m_index_unpublished = true;
+
+  log_removal(slot, ++m_generation);
+  remove_from_totals(handle);
+  mark_unpublished(handle);
+
+  if (m_walk_depth)
+    {
+      m_walk_graveyard.push_back(std::move(slot.transfer));
+      m_walk_freed_slots.push_back(handle);
+    }
+  else
+    {
+      slot.transfer.reset();
+      m_free_slots.push_back(handle);
+    }
+  slot.hash = 0;
+  slot.added = slot.modified = 0;
+  set_retired_usec(handle, 0);
+  --m_size;
+}
+
+void Model::touch(Handle handle)
+{
+  g_return_if_fail(handle < m_slots.size());
+  auto& slot = m_slots[handle];
+  g_return_if_fail(slot.transfer);
+
+  slot.modified = ++m_generation;
+
+  // the columns still hold the state from before this change
+  if (is_unfinished(slot.transfer->state))
+    set_retired_usec(handle, 0);
+  else if (is_unfinished(Transfer::State(m_columns.state[handle])))
+    set_retired_usec(handle, g_get_monotonic_time());
+
+  remove_from_totals(handle);
+  add_to_totals(handle);
+  mark_unpublished(handle);
+}
+
+/**
+ * Swaps in another transfer with the same id.
+ * The caller is responsible for touch()ing it.
+ */
+void Model::replace(Handle handle, const std::shared_ptr<Transfer>& transfer)
+{
+  g_return_if_fail(handle < m_slots.size());
+  auto& slot = m_slots[handle];
+  g_return_if_fail(slot.transfer && (slot.transfer->id == transfer->id));
+
+  // a for_each() visitor may be holding the old one
+  if (m_walk_depth)
+    m_walk_graveyard.push_back(std::move(slot.transfer));
+  slot.transfer = transfer;
+}
+
+void Model::set_retired_usec(Handle handle, int64_t retired_usec)
+{
+  auto& slot = m_slots[handle];
+  if (slot.retired_usec == retired_usec)
+    return;
+
+  if (slot.retired_usec != 0)
+    m_retired.erase(std::make_pair(slot.retired_usec, handle));
+  slot.retired_usec = retired_usec;
+  if (retired_usec != 0)
+    m_retired.emplace(retired_usec, handle);
+}
+
+void Model::mark_unpublished(Handle handle)
+{
+  auto& slot = m_slots[handle];
+  if (!slot.unpublished)
+    {
+      slot.unpublished = true;
+      m_unpublished.push_back(handle);
+    }
+}
+
+std::shared_ptr<const Model::Snapshot> Model::snapshot() const
+{
+  // the flags belong to the model's thread, so check that first
+  if (std::this_thread::get_id() != m_thread)
+    request_snapshot();
+  else if (m_snapshot_stale && !m_batch_depth)
+    {
+      m_snapshot_stale = false;
+      publish_snapshot();
+    }
+
+  return std::atomic_load(&m_snapshot);
+}
+
+/**
+ * Called from other threads' snapshot() calls so that the model's
+ * thread builds a fresh snapshot even if it never asks for one itself.
+ */
+void Model::request_snapshot() const
+{
+  // someone already asked, and hasn't been answered yet
+  if (m_snapshot_requested.exchange(true))
+    return;
+
+  std::lock_guard<std::mutex> lock(m_snapshot_idle_mutex);
+  if (m_snapshot_idle == nullptr)
+    {
+      m_snapshot_idle = g_idle_source_new();
+      g_source_set_callback(m_snapshot_idle, on_snapshot_idle, const_cast<Model*>(this), nullptr);
+      g_source_attach(m_snapshot_idle, m_context);
+    }
+}
+
+gboolean Model::on_snapshot_idle(gpointer gself)
+{
+  auto self = static_cast<const Model*>(gself);
+
+  {
+    std::lock_guard<std::mutex> lock(self->m_snapshot_idle_mutex);
+    g_source_unref(self->m_snapshot_idle);
+    self->m_snapshot_idle = nullptr;
+  }
+
+  // mid-batch, the request is left for the batch's end to answer
+  if (!self->m_batch_depth && self->m_snapshot_requested.exchange(false))
+    self->snapshot();
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * Publishes a new snapshot that shares the previous one's
+ * pages and chunks except for those holding unpublished slots.
+ */
+void Model::publish_snapshot() const
+{
+  if (m_unpublished.empty())
+    return;
+
+  typedef Snapshot::Chunk Chunk;
+  typedef Snapshot::Page Page;
+  static constexpr size_t fanout {Snapshot::FANOUT};
+  static constexpr size_t page_size {fanout * fanout};
+
+  const auto prev = std::atomic_load(&m_snapshot);
+  auto next = std::make_shared<Snapshot>();
+  next->m_generation = m_generation;
+  next->m_size = m_size;
+  next->m_totals = m_totals;
+  next->m_pages = prev->m_pages;
+  if (m_index_unpublished)
+    next->m_index = std::make_shared<const std::vector<Handle>>(m_index);
+  else
+    next->m_index = prev->m_index;
+  m_index_unpublished = false;
+
+  const auto n_pages = (m_slots.size() + page_size - 1) / page_size;
+  if (next->m_pages.size() < n_pages)
+    {
+      auto empty_page = std::make_shared<Page>();
+      empty_page->fill(std::make_shared<const Chunk>());
+      next->m_pages.resize(n_pages, empty_page);
+    }
+
+  // sorted, so each touched page and chunk is copied once
+  std::sort(m_unpublished.begin(), m_unpublished.end());
+  std::shared_ptr<Page> page;
+  std::shared_ptr<Chunk> chunk;
+  size_t page_index = 0;
+  size_t chunk_index = 0;
+  for (const auto handle : m_unpublished)
+    {
+      if (!page || (handle / page_size != page_index))
+        {
+          page_index = handle / page_size;
+          page = std::make_shared<Page>(*next->m_pages[page_index]);
+          next->m_pages[page_index] = page;
+          chunk.reset();
+        }
+
+      if (!chunk || ((handle % page_size) / fanout != chunk_index))
+        {
+          chunk_index = (handle % page_size) / fanout;
+          chunk = std::make_shared<Chunk>(*(*page)[chunk_index]);
+          (*page)[chunk_index] = chunk;
+        }
+
+      auto& slot = m_slots[handle];
+      slot.unpublished = false;
+      auto& published = (*chunk)[handle % fanout];
+      if (slot.transfer) // slices a source's subclass; see Snapshot
+        published = std::make_shared<const Transfer>(*slot.transfer);
+      else
+        published.reset();
+    }
+  m_unpublished.clear();
+
+  std::atomic_store(&m_snapshot, std::shared_ptr<const Snapshot>(std::move(next)));
+}
+
+/**
+ * Probes the snapshot's copy of the model's index the same way that
+ * find_bucket() does, comparing ids against the snapshot's own copies.
+ */
+std::shared_ptr<const Transfer> Model::Snapshot::get(const Transfer::Id& id) const
+{
+  const auto& index = *m_index;
+  if (index.empty())
+    return std::shared_ptr<const Transfer>();
+
+  const size_t mask = index.size() - 1;
+  for (size_t i=std::hash<Transfer::Id>()(id) & mask; ; i=(i+1) & mask)
+    {
+      const auto handle = index[i];
+      if (handle == INVALID_HANDLE)
+        return std::shared_ptr<const Transfer>();
+
+      const auto& transfer = (*(*m_pages[handle / (FANOUT*FANOUT)])[(handle / FANOUT) % FANOUT])[handle % FANOUT];
+      if (transfer->id == id)
+        return transfer;
+    }
+}
+
+std::vector<std::shared_ptr<const Transfer>> Model::Snapshot::get_all() const
+{
+  std::vector<std::shared_ptr<const Transfer>> transfers;
+  transfers.reserve(m_size);
+
+  for (const auto& page : m_pages)
+    for (const auto& chunk : *page)
+      for (const auto& transfer : *chunk)
+        if (transfer)
+          transfers.push_back(transfer);
+
+  return transfers;
+}
+
+Model::WalkGuard::WalkGuard(const Model& model):
+  m_model(model)
+{
+  ++m_model.m_walk_depth;
+}
+
+Model::WalkGuard::~WalkGuard()
+{
+  if (--m_model.m_walk_depth)
+    return;
+
+  // for_each() is const, but the visitor may have changed the model
+  // through a MutableModel, so now it's safe to reuse the freed slots
+  auto& model = const_cast<Model&>(m_model);
+  model.m_free_slots.insert(model.m_free_slots.end(),
+                            model.m_walk_freed_slots.begin(),
+                            model.m_walk_freed_slots.end());
+  model.m_walk_freed_slots.clear();
+
+  // swap first: destroying a transfer mustn't touch the graveyard it's in
+  std::vector<std::shared_ptr<Transfer>> graveyard;
+  graveyard.swap(model.m_walk_graveyard);
 }
 
 const core::Signal<Transfer::Id>& Model::changed() const
@@ -83,6 +690,16 @@ const core::Signal<Transfer::Id>& Model::removed() const
   return m_removed;
 }
 
+const core::Signal<Model::Changes>& Model::batch() const
+{
+  return m_batch;
+}
+
+bool Model::Changes::empty() const
+{
+  return added.empty() && changed.empty() && removed.empty();
+}
+
 /***
 ****
 ***/
@@ -95,22 +712,188 @@ void MutableModel::add(const std::shared_ptr<Transfer>& add_me)
 {
   const auto& id = add_me->id;
 
-  m_transfers[id] = add_me;
+  // replacing a transfer that was here before this batch counts as a removal
+  if ((get_handle(id) != INVALID_HANDLE) && !m_pending.added.count(id))
+    m_pending.removed.insert(id);
+  m_pending.changed.erase(id);
+  m_pending.added.insert(id);
+
+  insert(add_me);
   m_added(id);
+  flush_batch();
 }
 
 void MutableModel::remove(const Transfer::Id& id)
 {
-  auto it = m_transfers.find(id);
-  g_return_if_fail (it != m_transfers.end());
+  const auto handle = get_handle(id);
+  g_return_if_fail (handle != INVALID_HANDLE);
 
+  // keep the transfer alive in case 'id' is a reference to its id field
+  auto transfer = m_slots[handle].transfer;
   m_removed(id);
-  m_transfers.erase(it);
+
+  // a removed() listener may have already removed it
+  const auto still_here = get_handle(id);
+  if (still_here == INVALID_HANDLE)
+    return;
+  erase(still_here);
+
+  // a transfer that came and went in the same batch is a no-op
+  const bool added_in_batch = m_pending.added.erase(id) && !m_pending.removed.count(id);
+  m_pending.changed.erase(id);
+  if (!added_in_batch)
+    m_pending.removed.insert(id);
+  flush_batch();
 }
 
-void MutableModel::emit_changed(const Transfer::Id& id)
+void MutableModel::emit_changed(const Transfer::Id& id, Transfer::Fields fields)
 {
+  const auto handle = get_handle(id);
+  if (handle != INVALID_HANDLE)
+    touch(handle);
+
+  if (!m_pending.added.count(id))
+    m_pending.changed[id] |= fields;
+
   m_changed(id);
+  flush_batch();
+}
+
+void MutableModel::update(const std::shared_ptr<Transfer>& transfer, Transfer::Fields fields)
+{
+  const auto handle = get_handle(transfer->id);
+  if (handle == INVALID_HANDLE)
+    {
+      add(transfer);
+      return;
+    }
+
+  replace(handle, transfer);
+  emit_changed(transfer->id, fields);
+}
+
+void MutableModel::begin_batch()
+{
+  ++m_batch_depth;
+}
+
+void MutableModel::end_batch()
+{
+  g_return_if_fail(m_batch_depth > 0);
+
+  --m_batch_depth;
+  flush_batch();
+}
+
+void MutableModel::flush_batch()
+{
+  if (m_batch_depth > 0)
+    return;
+
+  // snapshot() builds the next one when it's wanted,
+  // which is now if another thread's already asked for it
+  m_snapshot_stale = true;
+  if (m_snapshot_requested.exchange(false))
+    snapshot();
+
+  // swap first in case a listener changes the model
+  Changes changes;
+  std::swap(changes, m_pending);
+  if (!changes.empty())
+    m_batch(changes);
+}
+
+void MutableModel::set_retention_policy(const RetentionPolicy& policy)
+{
+  m_retention_policy = policy;
+}
+
+const MutableModel::RetentionPolicy& MutableModel::get_retention_policy() const
+{
+  return m_retention_policy;
+}
+
+const MutableModel::RetentionStats& MutableModel::get_retention_stats() const
+{
+  return m_retention_stats;
+}
+
+/**
+ * Evicts for count and memory. Both are kept up to date as transfers
+ * change, so this costs nothing until one of them is over budget.
+ */
+std::vector<std::shared_ptr<Transfer>> MutableModel::prune()
+{
+  std::vector<std::shared_ptr<Transfer>> evicted;
+  const auto& policy = m_retention_policy;
+
+  const auto& n_in_state = get_totals().n_in_state;
+  int n_retired = n_in_state[Transfer::FINISHED]
+                + n_in_state[Transfer::CANCELED]
+                + n_in_state[Transfer::ERROR];
+  size_t n_bytes = m_n_bytes;
+  const bool over_count = policy.max_count && (n_retired > policy.max_count);
+  const bool over_bytes = policy.max_bytes && (n_bytes > policy.max_bytes);
+  if (!over_count && !over_bytes)
+    return evicted;
+
+  ++m_retention_stats.n_prunes;
+
+  // evicting the oldest first means that once one may stay, they all may
+  for (const auto& retired : m_retired)
+    {
+      const auto handle = retired.second;
+      if (policy.max_count && (n_retired > policy.max_count))
+        ++m_retention_stats.n_evicted_for_count;
+      else if (policy.max_bytes && (n_bytes > policy.max_bytes))
+        ++m_retention_stats.n_evicted_for_bytes;
+      else
+        break;
+
+      --n_retired;
+      n_bytes -= m_slots[handle].n_bytes;
+      evicted.push_back(m_slots[handle].transfer);
+    }
+
+  remove_evicted(evicted);
+  return evicted;
+}
+
+std::vector<std::shared_ptr<Transfer>> MutableModel::prune_expired()
+{
+  return prune_expired(g_get_monotonic_time());
+}
+
+std::vector<std::shared_ptr<Transfer>> MutableModel::prune_expired(int64_t now_usec)
+{
+  std::vector<std::shared_ptr<Transfer>> evicted;
+  const auto& policy = m_retention_policy;
+  if (!policy.max_age_sec)
+    return evicted;
+
+  ++m_retention_stats.n_prunes;
+
+  const int64_t max_age_usec = int64_t(policy.max_age_sec) * G_USEC_PER_SEC;
+  for (const auto& retired : m_retired)
+    {
+      if (now_usec - retired.first <= max_age_usec)
+        break;
+
+      ++m_retention_stats.n_evicted_for_age;
+      evicted.push_back(m_slots[retired.second].transfer);
+    }
+
+  remove_evicted(evicted);
+  return evicted;
+}
+
+void MutableModel::remove_evicted(const std::vector<std::shared_ptr<Transfer>>& evicted)
+{
+  begin_batch();
+  for (const auto& transfer : evicted)
+    if (count(transfer->id)) // a removed() listener may have beaten us to it
+      remove(transfer->id);
+  end_batch();
 }
 
 /***
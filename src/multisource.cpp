@@ -21,6 +21,7 @@
 
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace unity {
@@ -54,24 +55,33 @@ public:
 
     auto model = source->get_model();
 
-    m_connections.insert(
-      model->added().connect([this,idx](const Transfer::Id& id){
-        auto s = m_sources[idx];
-        m_id2source[id] = s;
-        m_model->add(s->get_model()->get(id));
-      })
-    );
+    // a source may already have transfers, e.g. ones restored from a journal
+    m_model->begin_batch();
+    for (const auto& transfer : model->get_all())
+      {
+        m_id2source[transfer->id] = source;
+        m_model->add(transfer);
+      }
+    m_model->end_batch();
 
+    // forward each batch as a batch so that our listeners see it as one
     m_connections.insert(
-      model->removed().connect([this](const Transfer::Id& id){
-        m_id2source.erase(id);
-        m_model->remove(id);
-      })
-    );
-
-    m_connections.insert(
-      model->changed().connect([this](const Transfer::Id& id){
-        m_model->emit_changed(id);
+      model->batch().connect([this,idx](const Model::Changes& changes){
+        auto s = m_sources[idx];
+        m_model->begin_batch();
+        for (const auto& id : changes.removed)
+          {
+            m_id2source.erase(id);
+            m_model->remove(id);
+          }
+        for (const auto& id : changes.added)
+          {
+            m_id2source[id] = s;
+            m_model->add(s->get_model()->get(id));
+          }
+        for (const auto& it : changes.changed)
+          m_model->emit_changed(it.first, it.second);
+        m_model->end_batch();
       })
     );
   }
@@ -140,7 +150,7 @@ private:
 
   std::shared_ptr<MutableModel> m_model;
   std::vector<std::shared_ptr<Source>> m_sources;
-  std::map<Transfer::Id,std::shared_ptr<Source>> m_id2source;
+  std::unordered_map<Transfer::Id,std::shared_ptr<Source>> m_id2source;
   std::set<core::ScopedConnection> m_connections;
 };
 
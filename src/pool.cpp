@@ -0,0 +1,121 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pool.h"
+
+#include <glib.h>
+
+#include <algorithm> // std::max()
+#include <new> // operator new
+
+namespace unity {
+namespace indicator {
+namespace transfer {
+
+constexpr size_t Pool::BLOCK_ALIGN;
+constexpr size_t Pool::MAX_BLOCK_SIZE;
+constexpr size_t Pool::DEFAULT_CHUNK_SIZE;
+
+Pool::Pool(size_t chunk_size):
+  m_chunk_size(std::max(chunk_size, MAX_BLOCK_SIZE)),
+  m_free_lists(get_size_class(MAX_BLOCK_SIZE)+1, nullptr)
+{
+}
+
+Pool::~Pool()
+{
+  if (m_stats.n_live != 0)
+    g_warning("%s: destroying a pool with %zu live blocks", G_STRLOC, m_stats.n_live);
+
+  for (auto chunk : m_chunks)
+    ::operator delete(chunk);
+}
+
+size_t Pool::get_size_class(size_t n_bytes)
+{
+  return (std::max(n_bytes, sizeof(FreeBlock)) + BLOCK_ALIGN - 1) / BLOCK_ALIGN;
+}
+
+void* Pool::allocate(size_t n_bytes)
+{
+  ++m_stats.n_allocs;
+  ++m_stats.n_live;
+  m_stats.bytes_live += n_bytes;
+  m_stats.peak_bytes_live = std::max(m_stats.peak_bytes_live, m_stats.bytes_live);
+
+  if (n_bytes > MAX_BLOCK_SIZE)
+    {
+      ++m_stats.n_large_allocs;
+      return ::operator new(n_bytes);
+    }
+
+  // reuse a freed block if we can...
+  const auto size_class = get_size_class(n_bytes);
+  auto& free_list = m_free_lists[size_class];
+  if (free_list != nullptr)
+    {
+      ++m_stats.n_reused;
+      auto block = free_list;
+      free_list = block->next;
+      return block;
+    }
+
+  // ...or else carve a new one out of the current chunk
+  const size_t block_size = size_class * BLOCK_ALIGN;
+  if (size_t(m_chunk_end - m_chunk_pos) < block_size)
+    {
+      auto chunk = static_cast<char*>(::operator new(m_chunk_size));
+      m_chunks.push_back(chunk);
+      m_chunk_pos = chunk;
+      m_chunk_end = chunk + m_chunk_size;
+      ++m_stats.n_chunks;
+      m_stats.bytes_reserved += m_chunk_size;
+    }
+
+  auto block = m_chunk_pos;
+  m_chunk_pos += block_size;
+  return block;
+}
+
+void Pool::deallocate(void* p, size_t n_bytes)
+{
+  if (p == nullptr)
+    return;
+
+  ++m_stats.n_frees;
+  --m_stats.n_live;
+  m_stats.bytes_live -= n_bytes;
+
+  if (n_bytes > MAX_BLOCK_SIZE)
+    {
+      ::operator delete(p);
+      return;
+    }
+
+  auto block = static_cast<FreeBlock*>(p);
+  auto& free_list = m_free_lists[get_size_class(n_bytes)];
+  block->next = free_list;
+  free_list = block;
+}
+
+Pool::Stats Pool::get_stats() const
+{
+  return m_stats;
+}
+
+} // namespace transfer
+} // namespace indicator
+} // namespace unity
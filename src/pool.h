@@ -0,0 +1,157 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDICATOR_TRANSFER_POOL_H
+#define INDICATOR_TRANSFER_POOL_H
+
+#include <cstddef> // size_t, std::max_align_t
+#include <cstdint> // uint64_t
+#include <memory> // std::shared_ptr
+#include <vector>
+
+namespace unity {
+namespace indicator {
+namespace transfer {
+
+/**
+ * \brief A free-list allocator for small objects that churn,
+ * such as Transfers and the nodes of the maps that index them.
+ *
+ * Blocks are carved out of large chunks and recycled through one free
+ * list per size class, so a burst of downloads coming and going reuses
+ * the same memory instead of fragmenting the heap. Requests larger than
+ * MAX_BLOCK_SIZE go straight to operator new.
+ *
+ * Chunks are only released when the Pool is destroyed, so a pool keeps
+ * its high-water mark: Stats::bytes_reserved never shrinks. This is
+ * deliberate. Returning a chunk would mean counting the live blocks in
+ * each chunk, finding a freed block's chunk, and pulling the chunk's blocks
+ * out of the free lists; that's a lookup on every free to save memory
+ * that the next burst would just ask for again. It's only a good trade
+ * for an owner whose peak tracks its live objects, like DMSource's: its
+ * retention policy caps the retired transfers, and it logs the pool's stats.
+ * An owner with a rare, much larger peak should use a Pool per burst instead.
+ *
+ * Not thread-safe.
+ */
+class Pool
+{
+public:
+
+    static constexpr size_t BLOCK_ALIGN {alignof(std::max_align_t)};
+    static constexpr size_t MAX_BLOCK_SIZE {1024};
+    static constexpr size_t DEFAULT_CHUNK_SIZE {64*1024};
+
+    struct Stats
+    {
+        uint64_t n_allocs = 0;
+        uint64_t n_frees = 0;
+        uint64_t n_reused = 0;         // allocations served from a free list
+        uint64_t n_large_allocs = 0;   // allocations too big to pool
+        size_t n_live = 0;
+        size_t bytes_live = 0;
+        size_t peak_bytes_live = 0;
+        size_t n_chunks = 0;
+        size_t bytes_reserved = 0;     // chunk memory, in use or not
+    };
+
+    explicit Pool(size_t chunk_size=DEFAULT_CHUNK_SIZE);
+    ~Pool();
+
+    void* allocate(size_t n_bytes);
+    void deallocate(void* p, size_t n_bytes);
+
+    Stats get_stats() const;
+
+private:
+
+    static size_t get_size_class(size_t n_bytes);
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    const size_t m_chunk_size;
+    std::vector<FreeBlock*> m_free_lists; // indexed by size class
+    std::vector<char*> m_chunks;
+    char* m_chunk_pos = nullptr;
+    char* m_chunk_end = nullptr;
+    Stats m_stats;
+
+    Pool(const Pool&) =delete;
+    Pool& operator=(const Pool&) =delete;
+};
+
+/**
+ * \brief A standard allocator that draws from a Pool.
+ *
+ * It holds a reference to the Pool so that the Pool outlives
+ * everything allocated from it, e.g. transfers allocated with
+ * std::allocate_shared() that outlive their Source.
+ */
+template<typename T>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+
+    explicit PoolAllocator(const std::shared_ptr<Pool>& pool): m_pool(pool) {}
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>& that): m_pool(that.pool()) {}
+
+    T* allocate(size_t n)
+    {
+        static_assert(alignof(T) <= Pool::BLOCK_ALIGN, "Pool blocks aren't aligned enough for T");
+        return static_cast<T*>(m_pool->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        m_pool->deallocate(p, n * sizeof(T));
+    }
+
+    const std::shared_ptr<Pool>& pool() const {return m_pool;}
+
+    // for containers that don't go through std::allocator_traits
+    template<typename U>
+    struct rebind
+    {
+        typedef PoolAllocator<U> other;
+    };
+
+private:
+    std::shared_ptr<Pool> m_pool;
+};
+
+template<typename T, typename U>
+bool operator==(const PoolAllocator<T>& a, const PoolAllocator<U>& b)
+{
+    return a.pool() == b.pool();
+}
+
+template<typename T, typename U>
+bool operator!=(const PoolAllocator<T>& a, const PoolAllocator<U>& b)
+{
+    return a.pool() != b.pool();
+}
+
+} // namespace transfer
+} // namespace indicator
+} // namespace unity
+
+#endif // INDICATOR_TRANSFER_POOL_H
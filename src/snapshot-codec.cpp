@@ -0,0 +1,564 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "snapshot-codec.h"
+
+#include <cstring> // memcpy()
+#include <set>
+#include <unordered_map>
+
+namespace unity {
+namespace indicator {
+namespace transfer {
+
+constexpr uint16_t SnapshotCodec::VERSION;
+constexpr Transfer::Fields SnapshotCodec::ALL_COLUMNS;
+
+namespace {
+
+/**
+ * The layout, with all numbers little-endian:
+ *
+ *   header:  MAGIC, u16 version, u8 Kind, u8 reserved,
+ *            u64 base generation, u64 generation,
+ *            u32 n_strings, u32 n_records, u32 n_removed
+ *   strings: n_strings of (varint length, bytes). index 0 is the
+ *            empty string and isn't stored, so the first one is index 1.
+ *   ids:     u32 string index[n_records]
+ *   removed: u32 string index[n_removed]
+ *   masks:   u16 Transfer::Fields[n_records], only in a DELTA
+ *   columns: for each field in COLUMNS, one value for each record whose
+ *            mask has that field, in record order
+ */
+static constexpr char MAGIC[4] {'I','T','S','S'};
+static constexpr size_t HEADER_SIZE {sizeof(MAGIC) + 2 + 1 + 1 + 8 + 8 + 4 + 4 + 4};
+
+enum Kind : uint8_t { FULL=1, DELTA=2 };
+
+static constexpr Transfer::Field COLUMNS[] {
+  Transfer::FIELD_STATE,        // u8
+  Transfer::FIELD_PROGRESS,     // f32
+  Transfer::FIELD_SECONDS_LEFT, // i32
+  Transfer::FIELD_TIME_STARTED, // i64
+  Transfer::FIELD_SPEED,        // u64
+  Transfer::FIELD_TOTAL_SIZE,   // u64
+  Transfer::FIELD_TITLE,        // u32 string index
+  Transfer::FIELD_APP_ICON,     // u32 string index
+  Transfer::FIELD_CUSTOM_STATE, // u32 string index
+  Transfer::FIELD_ERROR_STRING, // u32 string index
+  Transfer::FIELD_LOCAL_PATH    // u32 string index
+};
+
+bool is_string_column(Transfer::Field field)
+{
+  switch (field)
+    {
+      case Transfer::FIELD_TITLE:
+      case Transfer::FIELD_APP_ICON:
+      case Transfer::FIELD_CUSTOM_STATE:
+      case Transfer::FIELD_ERROR_STRING:
+      case Transfer::FIELD_LOCAL_PATH:
+        return true;
+
+      default:
+        return false;
+    }
+}
+
+const std::string& get_string(const Transfer& t, Transfer::Field field)
+{
+  switch (field)
+    {
+      case Transfer::FIELD_TITLE:        return t.title;
+      case Transfer::FIELD_APP_ICON:     return t.app_icon;
+      case Transfer::FIELD_CUSTOM_STATE: return t.custom_state();
+      case Transfer::FIELD_ERROR_STRING: return t.error_string();
+      default:                           return t.local_path();
+    }
+}
+
+void set_string(Transfer& t, Transfer::Field field, const std::string& str)
+{
+  switch (field)
+    {
+      case Transfer::FIELD_TITLE:        t.title = str; break;
+      case Transfer::FIELD_APP_ICON:     t.app_icon = str; break;
+      case Transfer::FIELD_CUSTOM_STATE: t.set_custom_state(str); break;
+      case Transfer::FIELD_ERROR_STRING: t.set_error_string(str); break;
+      default:                           t.set_local_path(str); break;
+    }
+}
+
+// the fields whose values differ between two versions of a transfer
+Transfer::Fields diff_fields(const Transfer& a, const Transfer& b)
+{
+  Transfer::Fields fields = 0;
+  if (a.state != b.state) fields |= Transfer::FIELD_STATE;
+  if (a.progress != b.progress) fields |= Transfer::FIELD_PROGRESS;
+  if (a.seconds_left != b.seconds_left) fields |= Transfer::FIELD_SECONDS_LEFT;
+  if (a.time_started != b.time_started) fields |= Transfer::FIELD_TIME_STARTED;
+  if (a.speed_Bps != b.speed_Bps) fields |= Transfer::FIELD_SPEED;
+  if (a.total_size != b.total_size) fields |= Transfer::FIELD_TOTAL_SIZE;
+  for (const auto field : COLUMNS)
+    if (is_string_column(field) && (get_string(a, field) != get_string(b, field)))
+      fields |= field;
+  return fields;
+}
+
+void copy_fields(const Transfer& from, Transfer::Fields fields, Transfer& to)
+{
+  if (fields & Transfer::FIELD_STATE) to.state = from.state;
+  if (fields & Transfer::FIELD_PROGRESS) to.progress = from.progress;
+  if (fields & Transfer::FIELD_SECONDS_LEFT) to.seconds_left = from.seconds_left;
+  if (fields & Transfer::FIELD_TIME_STARTED) to.time_started = from.time_started;
+  if (fields & Transfer::FIELD_SPEED) to.speed_Bps = from.speed_Bps;
+  if (fields & Transfer::FIELD_TOTAL_SIZE) to.total_size = from.total_size;
+  for (const auto field : COLUMNS)
+    if (is_string_column(field) && (fields & field))
+      set_string(to, field, get_string(from, field));
+}
+
+class Writer
+{
+public:
+  explicit Writer(size_t reserve) {m_buf.reserve(reserve);}
+
+  template<typename T> void put(T value) // unsigned integers
+  {
+    char bytes[sizeof(T)];
+    for (size_t i=0; i<sizeof(T); ++i)
+      bytes[i] = char(value >> (8*i));
+    m_buf.append(bytes, sizeof(T));
+  }
+
+  void put_float(float value)
+  {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put(bits);
+  }
+
+  void put_varint(uint32_t value)
+  {
+    while (value >= 0x80)
+      {
+        m_buf.push_back(char(value | 0x80));
+        value >>= 7;
+      }
+    m_buf.push_back(char(value));
+  }
+
+  void put_bytes(const char* bytes, size_t n) {m_buf.append(bytes, n);}
+
+  std::string& str() {return m_buf;}
+
+private:
+  std::string m_buf;
+};
+
+class Reader
+{
+public:
+  explicit Reader(const std::string& buf): m_pos(buf.data()), m_end(buf.data()+buf.size()) {}
+
+  size_t remaining() const {return size_t(m_end - m_pos);}
+
+  template<typename T> bool get(T& setme) // unsigned integers
+  {
+    if (remaining() < sizeof(T))
+      return false;
+    T value = 0;
+    for (size_t i=0; i<sizeof(T); ++i)
+      value |= T(uint8_t(m_pos[i])) << (8*i);
+    m_pos += sizeof(T);
+    setme = value;
+    return true;
+  }
+
+  bool get_float(float& setme)
+  {
+    uint32_t bits;
+    if (!get(bits))
+      return false;
+    memcpy(&setme, &bits, sizeof(setme));
+    return true;
+  }
+
+  bool get_varint(uint32_t& setme)
+  {
+    uint32_t value = 0;
+    for (int shift=0; (shift<35) && (m_pos<m_end); shift+=7)
+      {
+        const auto byte = uint8_t(*m_pos++);
+        value |= uint32_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+          {
+            setme = value;
+            return true;
+          }
+      }
+    return false;
+  }
+
+  bool get_bytes(size_t n, std::string& setme)
+  {
+    if (remaining() < n)
+      return false;
+    setme.assign(m_pos, n);
+    m_pos += n;
+    return true;
+  }
+
+private:
+  const char* m_pos;
+  const char* const m_end;
+};
+
+// the distinct strings in an encoding. index 0 is always the empty string.
+class StringTable
+{
+public:
+  uint32_t intern(const std::string& str)
+  {
+    if (str.empty())
+      return 0;
+    const auto it = m_index.emplace(str, uint32_t(m_strings.size() + 1));
+    if (it.second)
+      {
+        m_strings.push_back(&it.first->first);
+        m_bytes += str.size();
+      }
+    return it.first->second;
+  }
+
+  const std::vector<const std::string*>& strings() const {return m_strings;}
+  size_t bytes() const {return m_bytes;}
+
+private:
+  std::unordered_map<std::string,uint32_t> m_index;
+  std::vector<const std::string*> m_strings; // points into m_index's keys
+  size_t m_bytes = 0;
+};
+
+struct Row
+{
+  const Transfer* transfer;
+  Transfer::Fields fields;
+};
+
+std::string write(Kind kind,
+                  Model::Generation base_generation,
+                  Model::Generation generation,
+                  const std::vector<Row>& rows,
+                  const std::vector<Transfer::Id>& removed)
+{
+  // intern the strings first so that the table can go before the columns
+  StringTable strings;
+  std::vector<uint32_t> id_refs;
+  id_refs.reserve(rows.size());
+  for (const auto& row : rows)
+    id_refs.push_back(strings.intern(row.transfer->id.str()));
+  std::vector<uint32_t> removed_refs;
+  removed_refs.reserve(removed.size());
+  for (const auto& id : removed)
+    removed_refs.push_back(strings.intern(id.str()));
+  std::vector<uint32_t> string_refs;
+  for (const auto field : COLUMNS)
+    if (is_string_column(field))
+      for (const auto& row : rows)
+        if (row.fields & field)
+          string_refs.push_back(strings.intern(get_string(*row.transfer, field)));
+
+  // a generous guess: every string, a length byte each, and every column
+  Writer w(HEADER_SIZE
+           + strings.bytes() + strings.strings().size()
+           + 4*(id_refs.size() + removed_refs.size() + string_refs.size())
+           + rows.size()*(2 + 1 + 4 + 4 + 8 + 8 + 8));
+
+  w.put_bytes(MAGIC, sizeof(MAGIC));
+  w.put(uint16_t(SnapshotCodec::VERSION));
+  w.put(uint8_t(kind));
+  w.put(uint8_t(0));
+  w.put(uint64_t(base_generation));
+  w.put(uint64_t(generation));
+  w.put(uint32_t(strings.strings().size()));
+  w.put(uint32_t(rows.size()));
+  w.put(uint32_t(removed.size()));
+
+  for (const auto str : strings.strings())
+    {
+      w.put_varint(uint32_t(str->size()));
+      w.put_bytes(str->data(), str->size());
+    }
+
+  for (const auto ref : id_refs)
+    w.put(ref);
+  for (const auto ref : removed_refs)
+    w.put(ref);
+  if (kind == DELTA)
+    for (const auto& row : rows)
+      w.put(uint16_t(row.fields));
+
+  // string_refs are already in column order
+  auto string_ref = string_refs.begin();
+  for (const auto field : COLUMNS)
+    for (const auto& row : rows)
+      {
+        if (!(row.fields & field))
+          continue;
+        const auto& t = *row.transfer;
+        switch (field)
+          {
+            case Transfer::FIELD_STATE:        w.put(uint8_t(t.state)); break;
+            case Transfer::FIELD_PROGRESS:     w.put_float(t.progress); break;
+            case Transfer::FIELD_SECONDS_LEFT: w.put(uint32_t(int32_t(t.seconds_left))); break;
+            case Transfer::FIELD_TIME_STARTED: w.put(uint64_t(int64_t(t.time_started))); break;
+            case Transfer::FIELD_SPEED:        w.put(uint64_t(t.speed_Bps)); break;
+            case Transfer::FIELD_TOTAL_SIZE:   w.put(uint64_t(t.total_size)); break;
+            default:                           w.put(*string_ref++); break;
+          }
+      }
+
+  return std::move(w.str());
+}
+
+} // anonymous namespace
+
+/***
+****
+***/
+
+std::string SnapshotCodec::encode(const Model::Snapshot& snapshot)
+{
+  std::vector<Row> rows;
+  rows.reserve(snapshot.size());
+  snapshot.for_each([&rows](const Transfer& t){
+    rows.push_back(Row{&t, ALL_COLUMNS});
+  });
+
+  return write(FULL, 0, snapshot.generation(), rows, std::vector<Transfer::Id>());
+}
+
+std::string SnapshotCodec::encode_delta(const Model::Snapshot& older, const Model::Snapshot& newer)
+{
+  std::vector<Row> rows;
+  std::vector<Transfer::Id> removed;
+  newer.diff(older, [&rows, &removed](const Transfer* before, const Transfer* after){
+    if (before && after && (before->id == after->id))
+      {
+        const auto fields = diff_fields(*before, *after);
+        if (fields)
+          rows.push_back(Row{after, fields});
+        return;
+      }
+    // the handle was freed, taken, or reused by another transfer
+    if (before)
+      removed.push_back(before->id);
+    if (after)
+      rows.push_back(Row{after, ALL_COLUMNS});
+  });
+
+  return write(DELTA, older.generation(), newer.generation(), rows, removed);
+}
+
+bool SnapshotCodec::decode(const std::string& encoded, Decoded& setme)
+{
+  Reader r(encoded);
+
+  std::string magic;
+  uint16_t version;
+  uint8_t kind, reserved;
+  uint64_t base_generation, generation;
+  uint32_t n_strings, n_records, n_removed;
+  if (!r.get_bytes(sizeof(MAGIC), magic)
+      || (magic.compare(0, sizeof(MAGIC), MAGIC, sizeof(MAGIC)) != 0)
+      || !r.get(version) || (version > VERSION)
+      || !r.get(kind) || ((kind != FULL) && (kind != DELTA))
+      || !r.get(reserved)
+      || !r.get(base_generation)
+      || !r.get(generation)
+      || !r.get(n_strings)
+      || !r.get(n_records)
+      || !r.get(n_removed))
+    return false;
+
+  // each count's items take at least a byte, so this
+  // rejects garbage counts before anything is reserved
+  if ((n_strings > r.remaining())
+      || (n_records > r.remaining()/4)
+      || (n_removed > r.remaining()/4))
+    return false;
+
+  std::vector<std::string> strings(n_strings + 1);
+  for (uint32_t i=1; i<=n_strings; ++i)
+    {
+      uint32_t len;
+      if (!r.get_varint(len) || !r.get_bytes(len, strings[i]))
+        return false;
+    }
+
+  Decoded decoded;
+  decoded.is_delta = kind == DELTA;
+  decoded.base_generation = base_generation;
+  decoded.generation = generation;
+
+  // ids are interned only once the whole input has been read
+  std::vector<uint32_t> id_refs(n_records);
+  decoded.records.resize(n_records);
+  for (size_t i=0; i<n_records; ++i)
+    {
+      if (!r.get(id_refs[i]) || (id_refs[i] == 0) || (id_refs[i] > n_strings))
+        return false;
+      decoded.records[i].transfer = std::make_shared<Transfer>();
+    }
+
+  std::vector<uint32_t> removed_refs(n_removed);
+  for (auto& ref : removed_refs)
+    if (!r.get(ref) || (ref == 0) || (ref > n_strings))
+      return false;
+
+  if (decoded.is_delta)
+    for (auto& record : decoded.records)
+      {
+        uint16_t fields;
+        if (!r.get(fields) || (fields & ~ALL_COLUMNS))
+          return false;
+        record.fields = fields;
+      }
+
+  for (const auto field : COLUMNS)
+    for (auto& record : decoded.records)
+      {
+        if (!(record.fields & field))
+          continue;
+        auto& t = *record.transfer;
+        bool ok;
+        switch (field)
+          {
+            case Transfer::FIELD_STATE:
+              {
+                uint8_t state = 0;
+                ok = r.get(state) && (state <= Transfer::ERROR);
+                t.state = Transfer::State(state);
+                break;
+              }
+
+            case Transfer::FIELD_PROGRESS:
+              ok = r.get_float(t.progress);
+              break;
+
+            case Transfer::FIELD_SECONDS_LEFT:
+              {
+                uint32_t seconds_left;
+                ok = r.get(seconds_left);
+                t.seconds_left = int32_t(seconds_left);
+                break;
+              }
+
+            case Transfer::FIELD_TIME_STARTED:
+              {
+                uint64_t time_started;
+                ok = r.get(time_started);
+                t.time_started = time_t(int64_t(time_started));
+                break;
+              }
+
+            case Transfer::FIELD_SPEED:
+              ok = r.get(t.speed_Bps);
+              break;
+
+            case Transfer::FIELD_TOTAL_SIZE:
+              ok = r.get(t.total_size);
+              break;
+
+            default:
+              {
+                uint32_t ref;
+                ok = r.get(ref) && (ref <= n_strings);
+                if (ok)
+                  set_string(t, field, strings[ref]);
+                break;
+              }
+          }
+        if (!ok)
+          return false;
+      }
+
+  if (r.remaining() != 0)
+    return false;
+
+  for (size_t i=0; i<n_records; ++i)
+    decoded.records[i].transfer->id = Transfer::Id(strings[id_refs[i]]);
+
+  // an id that was never interned can't be in any model
+  decoded.removed.reserve(n_removed);
+  for (const auto ref : removed_refs)
+    {
+      const auto id = Transfer::Id::find(strings[ref]);
+      if (!id.empty())
+        decoded.removed.push_back(id);
+    }
+
+  setme = std::move(decoded);
+  return true;
+}
+
+bool SnapshotCodec::apply(const Decoded& decoded, MutableModel& model)
+{
+  bool in_sync = true;
+  model.begin_batch();
+
+  if (!decoded.is_delta)
+    {
+      std::set<Transfer::Id> keep;
+      for (const auto& record : decoded.records)
+        keep.insert(record.transfer->id);
+      for (const auto& id : model.get_ids())
+        if (!keep.count(id))
+          model.remove(id);
+    }
+
+  for (const auto& id : decoded.removed)
+    if (model.count(id))
+      model.remove(id);
+
+  for (const auto& record : decoded.records)
+    {
+      if (record.fields == ALL_COLUMNS)
+        {
+          model.update(record.transfer);
+          continue;
+        }
+
+      const auto existing = model.get(record.transfer->id);
+      if (!existing)
+        {
+          in_sync = false;
+          continue;
+        }
+
+      auto transfer = std::make_shared<Transfer>(*existing);
+      copy_fields(*record.transfer, record.fields, *transfer);
+      model.update(transfer, record.fields);
+    }
+
+  model.end_batch();
+  return in_sync;
+}
+
+} // namespace transfer
+} // namespace indicator
+} // namespace unity
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDICATOR_TRANSFER_SNAPSHOT_CODEC_H
+#define INDICATOR_TRANSFER_SNAPSHOT_CODEC_H
+
+#include <transfer/model.h>
+#include <transfer/transfer.h>
+
+#include <cstdint>
+#include <memory> // std::shared_ptr
+#include <string>
+#include <vector>
+
+namespace unity {
+namespace indicator {
+namespace transfer {
+
+/**
+ * \brief A compact, versioned binary encoding of Model snapshots
+ *
+ * An encoding is either a full snapshot or a delta that turns one
+ * snapshot into a later one. Either way it's a header, a table of the
+ * distinct strings, and then one fixed-width column per Transfer field.
+ * Strings are referred to by their index in the table, so ids, titles,
+ * and icons that repeat across transfers are only stored once.
+ *
+ * In a delta, each record carries a mask of the fields that changed,
+ * and a column only holds values for the records whose mask has its
+ * field. A progress update costs a few bytes rather than a transfer.
+ *
+ * Numbers are little-endian, so an encoding can be stored or sent to
+ * another host. Decoders reject encodings with a newer VERSION.
+ */
+class SnapshotCodec
+{
+public:
+
+    static constexpr uint16_t VERSION {1};
+
+    // the Transfer::Fields that have a column
+    static constexpr Transfer::Fields ALL_COLUMNS = Transfer::FIELD_PROGRESS
+                                                  | Transfer::FIELD_SECONDS_LEFT
+                                                  | Transfer::FIELD_SPEED
+                                                  | Transfer::FIELD_TOTAL_SIZE
+                                                  | Transfer::FIELD_STATE
+                                                  | Transfer::FIELD_CUSTOM_STATE
+                                                  | Transfer::FIELD_TITLE
+                                                  | Transfer::FIELD_APP_ICON
+                                                  | Transfer::FIELD_LOCAL_PATH
+                                                  | Transfer::FIELD_ERROR_STRING
+                                                  | Transfer::FIELD_TIME_STARTED;
+
+    static std::string encode(const Model::Snapshot&);
+    static std::string encode_delta(const Model::Snapshot& older, const Model::Snapshot& newer);
+
+    struct Record
+    {
+        // only the id and the fields in 'fields' are set
+        std::shared_ptr<Transfer> transfer;
+        Transfer::Fields fields = ALL_COLUMNS;
+    };
+
+    struct Decoded
+    {
+        bool is_delta = false;
+        Model::Generation base_generation = 0; // the generation a delta applies to
+        Model::Generation generation = 0;
+        std::vector<Record> records;           // the transfers added or changed
+        std::vector<Transfer::Id> removed;     // only the ids that this process knows
+    };
+
+    // returns false if the encoding is truncated, corrupt, or too new
+    static bool decode(const std::string& encoded, Decoded& setme);
+
+    /**
+     * Applies a decoded snapshot to a replica in one batch.
+     * A full snapshot also removes the transfers that aren't in it.
+     * Complete records are added as they are, sharing their Transfers
+     * with 'decoded', and partial ones are merged into copies of the
+     * transfers they change. Either way the model's transfers are swapped
+     * with MutableModel::update(), so this is meant for replicas rather
+     * than a source's own model.
+     *
+     * Returns false if a delta changes a transfer the model doesn't have,
+     * which means the replica was out of sync and needs a full snapshot.
+     */
+    static bool apply(const Decoded&, MutableModel&);
+};
+
+} // namespace transfer
+} // namespace indicator
+} // namespace unity
+
+#endif // INDICATOR_TRANSFER_SNAPSHOT_CODEC_H
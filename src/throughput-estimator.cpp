@@ -0,0 +1,129 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "throughput-estimator.h"
+
+#include <glib.h> // g_get_monotonic_time()
+
+namespace unity {
+namespace indicator {
+namespace transfer {
+
+/***
+****
+***/
+
+ThroughputEstimator::ThroughputEstimator(Mode mode,
+                                         size_t capacity,
+                                         int64_t max_age_usec,
+                                         double ewma_alpha):
+  m_mode(mode),
+  m_max_age_usec(max_age_usec),
+  m_ewma_alpha(CLAMP(ewma_alpha, 0.0, 1.0)),
+  m_samples(MAX(capacity, size_t(2)))
+{
+}
+
+void ThroughputEstimator::add_sample(uint64_t bytes)
+{
+  add_sample(g_get_monotonic_time(), bytes);
+}
+
+void ThroughputEstimator::add_sample(int64_t time_usec, uint64_t bytes)
+{
+  if (m_count > 0)
+    {
+      const auto& prev = newest();
+
+      // if the transfer restarted or the clock misbehaved, start over
+      if ((bytes < prev.bytes) || (time_usec < prev.time_usec))
+        {
+          reset();
+        }
+      else if (m_mode == EWMA && (time_usec > prev.time_usec))
+        {
+          const double Bps = (bytes - prev.bytes) * 1000000.0 / (time_usec - prev.time_usec);
+          if (m_count == 1)
+            m_ewma_Bps = Bps;
+          else
+            m_ewma_Bps = m_ewma_alpha*Bps + (1.0-m_ewma_alpha)*m_ewma_Bps;
+        }
+    }
+
+  // make room for the new sample
+  if (m_count == m_samples.size())
+    drop_oldest();
+
+  m_samples[(m_head + m_count) % m_samples.size()] = Sample{time_usec, bytes};
+  ++m_count;
+
+  // limit the window to the last max_age_usec
+  const auto oldest_allowed_usec = time_usec - m_max_age_usec;
+  while (m_count > 1 && oldest().time_usec < oldest_allowed_usec)
+    drop_oldest();
+}
+
+uint64_t ThroughputEstimator::get_Bps() const
+{
+  if (m_count < 2)
+    return 0;
+
+  if (m_mode == EWMA)
+    return uint64_t(m_ewma_Bps);
+
+  const auto& a = oldest();
+  const auto& b = newest();
+  const auto usec = b.time_usec - a.time_usec;
+  if (usec <= 0)
+    return 0;
+
+  return ((b.bytes - a.bytes) * 1000000) / uint64_t(usec);
+}
+
+void ThroughputEstimator::reset()
+{
+  m_head = 0;
+  m_count = 0;
+  m_ewma_Bps = 0;
+}
+
+/***
+****
+***/
+
+const ThroughputEstimator::Sample& ThroughputEstimator::oldest() const
+{
+  return m_samples[m_head];
+}
+
+const ThroughputEstimator::Sample& ThroughputEstimator::newest() const
+{
+  return m_samples[(m_head + m_count - 1) % m_samples.size()];
+}
+
+void ThroughputEstimator::drop_oldest()
+{
+  m_head = (m_head + 1) % m_samples.size();
+  --m_count;
+}
+
+/***
+****
+***/
+
+} // namespace transfer
+} // namespace indicator
+} // namespace unity
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDICATOR_TRANSFER_THROUGHPUT_ESTIMATOR_H
+#define INDICATOR_TRANSFER_THROUGHPUT_ESTIMATOR_H
+
+#include <cstddef> // size_t
+#include <cstdint> // int64_t, uint64_t
+#include <vector>
+
+namespace unity {
+namespace indicator {
+namespace transfer {
+
+/**
+ * \brief Estimates a Transfer's speed from (time, bytes received) samples
+ *
+ * Samples are kept in a fixed-capacity ring buffer that's allocated
+ * once at construction, so adding samples never allocates.
+ * Timestamps are expected to come from a monotonic clock such as
+ * g_get_monotonic_time() so that wall clock jumps don't skew the ETA.
+ *
+ * In WINDOWED mode the speed is averaged across the samples that are
+ * both among the last `capacity` samples and no older than `max_age_usec`.
+ * In EWMA mode it's an exponentially-weighted moving average of the
+ * speed between consecutive samples.
+ */
+class ThroughputEstimator
+{
+public:
+
+    typedef enum { WINDOWED, EWMA } Mode;
+
+    explicit ThroughputEstimator(Mode mode = WINDOWED,
+                                 size_t capacity = 50,
+                                 int64_t max_age_usec = 30 * 1000000,
+                                 double ewma_alpha = 0.3);
+
+    // bytes is the running total, not the delta since the last sample
+    void add_sample(int64_t time_usec, uint64_t bytes);
+
+    // convenience wrapper that uses g_get_monotonic_time()
+    void add_sample(uint64_t bytes);
+
+    // the estimated speed in bytes per second, or 0 if not yet known
+    uint64_t get_Bps() const;
+
+    // forget all samples, e.g. when a transfer is paused
+    void reset();
+
+    Mode mode() const { return m_mode; }
+    size_t capacity() const { return m_samples.size(); }
+    size_t size() const { return m_count; }
+
+private:
+
+    struct Sample
+    {
+        int64_t time_usec;
+        uint64_t bytes;
+    };
+
+    const Sample& oldest() const;
+    const Sample& newest() const;
+    void drop_oldest();
+
+    const Mode m_mode;
+    const int64_t m_max_age_usec;
+    const double m_ewma_alpha;
+
+    std::vector<Sample> m_samples;
+    size_t m_head = 0;  // index of the oldest sample
+    size_t m_count = 0;
+    double m_ewma_Bps = 0;
+};
+
+} // namespace transfer
+} // namespace indicator
+} // namespace unity
+
+#endif // INDICATOR_TRANSFER_THROUGHPUT_ESTIMATOR_H
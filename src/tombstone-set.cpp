@@ -0,0 +1,101 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tombstone-set.h"
+
+#include <algorithm> // std::max()
+
+namespace unity {
+namespace indicator {
+namespace transfer {
+
+/***
+****
+***/
+
+TombstoneSet::TombstoneSet(size_t capacity):
+  m_capacity(std::max(capacity, size_t(1)))
+{
+}
+
+void TombstoneSet::insert(const std::string& ccad_path)
+{
+  if (touch(ccad_path))
+    return;
+
+  if (m_index.size() >= m_capacity)
+    evict_oldest();
+
+  auto it = m_index.emplace(ccad_path, m_lru.end()).first;
+  m_lru.push_front(&it->first);
+  it->second = m_lru.begin();
+  m_bytes += entry_bytes(ccad_path);
+}
+
+bool TombstoneSet::contains(const std::string& ccad_path)
+{
+  return touch(ccad_path);
+}
+
+void TombstoneSet::clear()
+{
+  if (!m_index.empty())
+    ++m_stats.n_clears;
+
+  m_lru.clear();
+  m_index.clear();
+  m_bytes = 0;
+}
+
+TombstoneSet::Stats TombstoneSet::stats() const
+{
+  auto stats = m_stats;
+  stats.n_entries = m_index.size();
+  stats.n_bytes = m_bytes;
+  return stats;
+}
+
+// if ccad_path is present, mark it as most-recently-used
+bool TombstoneSet::touch(const std::string& ccad_path)
+{
+  auto it = m_index.find(ccad_path);
+  if (it == m_index.end())
+    return false;
+
+  m_lru.splice(m_lru.begin(), m_lru, it->second);
+  return true;
+}
+
+void TombstoneSet::evict_oldest()
+{
+  auto it = m_index.find(*m_lru.back());
+  m_bytes -= entry_bytes(it->first);
+  m_lru.pop_back();
+  m_index.erase(it);
+  ++m_stats.n_evictions;
+}
+
+size_t TombstoneSet::entry_bytes(const std::string& ccad_path)
+{
+  // the key, plus a hash node and a list node
+  return ccad_path.capacity()
+       + sizeof(std::pair<const std::string,lru_t::iterator>) + 2*sizeof(void*)
+       + sizeof(const std::string*) + 2*sizeof(void*);
+}
+
+} // namespace transfer
+} // namespace indicator
+} // namespace unity
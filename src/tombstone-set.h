@@ -0,0 +1,83 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDICATOR_TRANSFER_TOMBSTONE_SET_H
+#define INDICATOR_TRANSFER_TOMBSTONE_SET_H
+
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+#include <list>
+#include <string>
+#include <unordered_map>
+
+namespace unity {
+namespace indicator {
+namespace transfer {
+
+/**
+ * \brief A bounded set of ccad paths that must not get transfers; e.g.
+ * because the user cleared them, or because they have ShowInIndicator=false.
+ *
+ * Background services can create thousands of hidden downloads over a
+ * session, so once the set is full the least-recently-used path is
+ * evicted. That's harmless: an evicted hidden download that signals
+ * again just costs one more GetAll() before it's re-added here.
+ * The owner should clear() the set when DownloadManager leaves the bus,
+ * since its object paths die with it.
+ */
+class TombstoneSet
+{
+public:
+
+    struct Stats
+    {
+        size_t n_entries = 0;
+        size_t n_bytes = 0; // approximate
+        uint64_t n_evictions = 0;
+        uint64_t n_clears = 0;
+    };
+
+    explicit TombstoneSet(size_t capacity);
+
+    void insert(const std::string& ccad_path);
+
+    // a hit marks the path as most-recently-used
+    bool contains(const std::string& ccad_path);
+
+    void clear();
+
+    Stats stats() const;
+
+private:
+
+    typedef std::list<const std::string*> lru_t;
+
+    bool touch(const std::string& ccad_path);
+    void evict_oldest();
+    static size_t entry_bytes(const std::string& ccad_path);
+
+    const size_t m_capacity;
+    lru_t m_lru; // most-recently-used first
+    std::unordered_map<std::string,lru_t::iterator> m_index;
+    size_t m_bytes = 0;
+    Stats m_stats;
+};
+
+} // namespace transfer
+} // namespace indicator
+} // namespace unity
+
+#endif // INDICATOR_TRANSFER_TOMBSTONE_SET_H
@@ -19,7 +19,12 @@
 
 #include <transfer/transfer.h>
 
-#include <cstdio> // std::snprintf()
+#include <atomic>
+#include <cstring> // strlen()
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
 
 namespace unity {
 namespace indicator {
@@ -29,13 +34,139 @@ namespace transfer {
 ****
 ***/
 
-std::string Transfer::next_unique_id()
+namespace
+{
+  /**
+   * Canonical decimal strings like the ones next_unique_id() hands out
+   * are their own value, so they round-trip through D-Bus without
+   * being interned. All other strings are interned and get a value
+   * with INTERNED set.
+   */
+  constexpr uint32_t INTERNED {1u<<31};
+
+  uint32_t parse_decimal(const char* str, size_t len)
+  {
+    if ((len == 0) || (len > 10) || (str[0] < '1') || (str[0] > '9'))
+      return 0;
+
+    uint64_t value = 0;
+    for (size_t i=0; i<len; ++i)
+      {
+        if ((str[i] < '0') || (str[i] > '9'))
+          return 0;
+        value = value*10 + uint32_t(str[i]-'0');
+      }
+
+    return value < INTERNED ? uint32_t(value) : 0;
+  }
+
+  class IdRegistry
+  {
+  public:
+    static IdRegistry& get()
+    {
+      static IdRegistry registry;
+      return registry;
+    }
+
+    uint32_t intern(const char* str, size_t len)
+    {
+      if (len == 0)
+        return 0;
+
+      const auto value = parse_decimal(str, len);
+      if (value != 0)
+        return value;
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      const auto it = m_values.emplace(std::string(str, len), INTERNED | m_interned.size());
+      if (it.second)
+        m_interned.push_back(&it.first->first);
+      return it.first->second;
+    }
+
+    uint32_t find(const char* str, size_t len)
+    {
+      if (len == 0)
+        return 0;
+
+      const auto value = parse_decimal(str, len);
+      if (value != 0)
+        return value;
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      const auto it = m_values.find(std::string(str, len));
+      return it != m_values.end() ? it->second : 0;
+    }
+
+    std::string str(uint32_t value)
+    {
+      if (value == 0)
+        return std::string();
+
+      // decimal strings are built on demand rather than kept
+      if (!(value & INTERNED))
+        return std::to_string(value);
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return *m_interned[value & ~INTERNED];
+    }
+
+  private:
+    std::mutex m_mutex;
+    std::unordered_map<std::string,uint32_t> m_values;
+    std::vector<const std::string*> m_interned; // indexed by value & ~INTERNED
+  };
+}
+
+Transfer::Id::Id(const std::string& str):
+  m_value(IdRegistry::get().intern(str.c_str(), str.size()))
 {
-  static unsigned int next = 1000;
-  char buf[32];
-  std::snprintf(buf, sizeof(buf), "%u", next);
-  ++next;
-  return buf;
+}
+
+Transfer::Id::Id(const char* str):
+  m_value(str ? IdRegistry::get().intern(str, strlen(str)) : 0)
+{
+}
+
+Transfer::Id Transfer::Id::find(const std::string& str)
+{
+  return Id(IdRegistry::get().find(str.c_str(), str.size()));
+}
+
+Transfer::Id Transfer::Id::find(const char* str)
+{
+  return Id(str ? IdRegistry::get().find(str, strlen(str)) : 0);
+}
+
+std::string Transfer::Id::str() const
+{
+  return IdRegistry::get().str(m_value);
+}
+
+std::ostream& operator<<(std::ostream& os, const Transfer::Id& id)
+{
+  return os << id.str();
+}
+
+namespace
+{
+  std::atomic<uint32_t> next_unique_value {1000};
+}
+
+Transfer::Id Transfer::next_unique_id()
+{
+  return Id(next_unique_value++);
+}
+
+void Transfer::reserve_unique_id(const Id& id)
+{
+  if (id.m_value & INTERNED)
+    return;
+
+  auto next = next_unique_value.load();
+  while ((next <= id.m_value) && !next_unique_value.compare_exchange_weak(next, id.m_value+1))
+    ;
 }
 
 bool Transfer::can_start() const
@@ -67,6 +198,88 @@ bool Transfer::can_clear() const
 ****
 ***/
 
+namespace
+{
+  const std::string empty_string;
+}
+
+Transfer::Transfer(const Transfer& that)
+{
+  *this = that;
+}
+
+Transfer& Transfer::operator=(const Transfer& that)
+{
+  state = that.state;
+  seconds_left = that.seconds_left;
+  time_started = that.time_started;
+  progress = that.progress;
+  speed_Bps = that.speed_Bps;
+  total_size = that.total_size;
+  id = that.id;
+  title = that.title;
+  app_icon = that.app_icon;
+  m_extras.reset(that.m_extras ? new Extras(*that.m_extras) : nullptr);
+  return *this;
+}
+
+Transfer::Extras& Transfer::extras()
+{
+  if (!m_extras)
+    m_extras.reset(new Extras());
+  return *m_extras;
+}
+
+const std::string& Transfer::custom_state() const
+{
+  return m_extras ? m_extras->custom_state : empty_string;
+}
+
+void Transfer::set_custom_state(const std::string& custom_state_in)
+{
+  if (m_extras || !custom_state_in.empty())
+    extras().custom_state = custom_state_in;
+}
+
+const std::string& Transfer::error_string() const
+{
+  return m_extras ? m_extras->error_string : empty_string;
+}
+
+void Transfer::set_error_string(const std::string& error_string_in)
+{
+  if (m_extras || !error_string_in.empty())
+    extras().error_string = error_string_in;
+}
+
+const std::string& Transfer::local_path() const
+{
+  return m_extras ? m_extras->local_path : empty_string;
+}
+
+void Transfer::set_local_path(const std::string& local_path_in)
+{
+  if (m_extras || !local_path_in.empty())
+    extras().local_path = local_path_in;
+}
+
+size_t Transfer::memory_usage() const
+{
+  size_t n_bytes = sizeof(Transfer) + title.capacity() + app_icon.capacity();
+
+  if (m_extras)
+    n_bytes += sizeof(Extras)
+             + m_extras->custom_state.capacity()
+             + m_extras->error_string.capacity()
+             + m_extras->local_path.capacity();
+
+  return n_bytes;
+}
+
+/***
+****
+***/
+
 } // namespace transfer
 } // namespace indicator
 } // namespace unity
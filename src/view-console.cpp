@@ -51,15 +51,15 @@ static std::string dump_transfer(const std::shared_ptr<Transfer>& transfer)
 {
   auto tmp = g_strdup_printf ("state [%d] id [%s] title[%s] app_icon[%s] time_started[%zu] seconds_left[%d] speed[%f KiB/s] progress[%f] error_string[%s] local_path[%s]",
                               (int)transfer->state,
-                              transfer->id.c_str(),
+                              transfer->id.str().c_str(),
                               transfer->title.c_str(),
                               transfer->app_icon.c_str(),
                               (size_t)transfer->time_started,
                               transfer->seconds_left,
                               transfer->speed_Bps/1024.0,
                               transfer->progress,
-                              transfer->error_string.c_str(),
-                              transfer->local_path.c_str());
+                              transfer->error_string().c_str(),
+                              transfer->local_path().c_str());
   std::string ret = tmp;
   g_free(tmp);
   return ret;
@@ -26,6 +26,8 @@
 #include <glib/gi18n.h>
 #include <gio/gio.h>
 
+#include <unordered_map>
+
 namespace unity {
 namespace indicator {
 namespace transfer {
@@ -80,24 +82,22 @@ public:
     auto& c = m_connections;
     c.clear();
     if (m_model)
-        for (const auto& id : m_model->get_ids())
-          remove(id);
+        m_model->for_each([this](const Transfer& transfer){remove(transfer.id);});
 
     // ...in with the new
     if ((m_model = model))
       {
-        c.insert(m_model->added().connect([this](const Transfer::Id& id){add(id);}));
-        c.insert(m_model->changed().connect([this](const Transfer::Id& id){update(id);}));
-        c.insert(m_model->removed().connect([this](const Transfer::Id& id){remove(id);}));
+        c.insert(m_model->batch().connect([this](const Model::Changes& changes){update(changes);}));
 
         // add the transfers
-        for (const auto& id : m_model->get_ids())
-          add(id);
+        m_model->for_each([this](const Transfer& transfer){add(transfer.id);});
       }
   }
 
   ~GActions()
   {
+    for (auto& it : m_transfer_actions)
+      g_object_unref(it.second);
     g_clear_object(&m_action_group);
   }
 
@@ -112,30 +112,61 @@ private:
   ****  TRANSFER STATES
   ***/
 
+  // the fields that create_transfer_state() reads
+  static constexpr Transfer::Fields STATE_FIELDS = Transfer::FIELD_PROGRESS
+                                                 | Transfer::FIELD_SECONDS_LEFT
+                                                 | Transfer::FIELD_STATE
+                                                 | Transfer::FIELD_CUSTOM_STATE;
+
+  void update(const Model::Changes& changes)
+  {
+    for (const auto& id : changes.removed)
+      remove(id);
+    for (const auto& id : changes.added)
+      add(id);
+    for (const auto& it : changes.changed)
+      if (it.second & STATE_FIELDS)
+        update(it.first);
+  }
+
   void add(const Transfer::Id& id)
   {
     const auto name = get_transfer_action_name(id);
     const auto state = create_transfer_state(id);
     auto a = g_simple_action_new_stateful(name.c_str(), nullptr, state);
     g_action_map_add_action(action_map(), G_ACTION(a));
+
+    // keep our ref so that update() needn't build the name to find it
+    auto& action = m_transfer_actions[id];
+    if (action != nullptr)
+      g_object_unref(action);
+    action = a;
   }
 
   void update(const Transfer::Id& id)
   {
-    const auto name = get_transfer_action_name(id);
-    const auto state = create_transfer_state(id);
-    g_action_group_change_action_state(action_group(), name.c_str(), state);
+    const auto it = m_transfer_actions.find(id);
+    if (it == m_transfer_actions.end())
+      return;
+
+    g_simple_action_set_state(it->second, create_transfer_state(id));
   }
 
   void remove(const Transfer::Id& id)
   {
+    const auto it = m_transfer_actions.find(id);
+    if (it == m_transfer_actions.end())
+      return;
+
     const auto name = get_transfer_action_name(id);
     g_action_map_remove_action(action_map(), name.c_str());
+    g_object_unref(it->second);
+    m_transfer_actions.erase(it);
   }
 
   std::string get_transfer_action_name (const Transfer::Id& id)
   {
-    return std::string("transfer-state.") + id;
+    return std::string("transfer-state.") + id.str();
   }
 
   GVariant* create_transfer_state(const Transfer::Id& id)
@@ -160,7 +191,7 @@ private:
           }
 
         g_variant_builder_add(&b, "{sv}", "state", g_variant_new_int32(transfer->state));
-        g_variant_builder_add(&b, "{sv}", "state-label", g_variant_new_string(transfer->custom_state.c_str()));
+        g_variant_builder_add(&b, "{sv}", "state-label", g_variant_new_string(transfer->custom_state().c_str()));
       }
     else
       {
@@ -179,40 +210,40 @@ private:
     return m_controller;
   }
 
+  // the uids come from other processes, so look them up without interning them
+  static Transfer::Id get_uid(GVariant* vuid)
+  {
+    return Transfer::Id::find(g_variant_get_string(vuid, nullptr));
+  }
+
   static void on_tap(GSimpleAction*, GVariant* vuid, gpointer gself)
   {
-    const auto uid = g_variant_get_string(vuid, nullptr);
-    static_cast<GActions*>(gself)->controller()->tap(uid);
+    static_cast<GActions*>(gself)->controller()->tap(get_uid(vuid));
   }
 
   static void on_cancel(GSimpleAction*, GVariant* vuid, gpointer gself)
   {
-    const auto uid = g_variant_get_string(vuid, nullptr);
-    static_cast<GActions*>(gself)->controller()->cancel(uid);
+    static_cast<GActions*>(gself)->controller()->cancel(get_uid(vuid));
   }
 
   static void on_pause(GSimpleAction*, GVariant* vuid, gpointer gself)
   {
-    const auto uid = g_variant_get_string(vuid, nullptr);
-    static_cast<GActions*>(gself)->controller()->pause(uid);
+    static_cast<GActions*>(gself)->controller()->pause(get_uid(vuid));
   }
 
   static void on_resume(GSimpleAction*, GVariant* vuid, gpointer gself)
   {
-    const auto uid = g_variant_get_string(vuid, nullptr);
-    static_cast<GActions*>(gself)->controller()->resume(uid);
+    static_cast<GActions*>(gself)->controller()->resume(get_uid(vuid));
   }
 
   static void on_open(GSimpleAction*, GVariant* vuid, gpointer gself)
   {
-    const auto uid = g_variant_get_string(vuid, nullptr);
-    static_cast<GActions*>(gself)->controller()->open(uid);
+    static_cast<GActions*>(gself)->controller()->open(get_uid(vuid));
   }
 
   static void on_open_app(GSimpleAction*, GVariant* vuid, gpointer gself)
   {
-    const auto uid = g_variant_get_string(vuid, nullptr);
-    static_cast<GActions*>(gself)->controller()->open_app(uid);
+    static_cast<GActions*>(gself)->controller()->open_app(get_uid(vuid));
   }
 
   static void on_resume_all(GSimpleAction*, GVariant*, gpointer gself)
@@ -252,6 +283,7 @@ private:
   }
 
   GSimpleActionGroup* m_action_group = nullptr;
+  std::unordered_map<Transfer::Id,GSimpleAction*> m_transfer_actions;
   std::shared_ptr<const Model> m_model;
   std::shared_ptr<Controller> m_controller;
   std::set<core::ScopedConnection> m_connections;
@@ -308,13 +340,11 @@ public:
 
     if ((m_model = model))
       {
-        c.insert(m_model->added().connect([this](const Transfer::Id& id){add(id);}));
-        c.insert(m_model->changed().connect([this](const Transfer::Id& id){update(id);}));
-        c.insert(m_model->removed().connect([this](const Transfer::Id& id){remove(id);}));
+        c.insert(m_model->batch().connect([this](const Model::Changes& changes){update(changes);}));
 
         // add the transfers
-        for (const auto& id : m_model->get_ids())
-          add(id);
+        m_model->for_each([this](const Transfer& transfer){add(transfer.id);});
+        update_bulk_menu_items();
       }
 
     update_header();
@@ -378,43 +408,16 @@ private:
 
   GVariant* get_header_icon() const
   {
-    int n_in_progress = 0;
-    int n_failed = 0;
-    int n_paused = 0;
-
-    for (auto it=m_visible_transfers.cbegin(); it!=m_visible_transfers.cend(); ++it)
-      {
-        auto transfer = m_model->get((*it).first);
-        switch (transfer->state)
-          {
-            case Transfer::RUNNING:
-            case Transfer::HASHING:
-            case Transfer::PROCESSING:
-              ++n_in_progress;
-              break;
-
-            case Transfer::PAUSED:
-              ++n_paused;
-              break;
-
-            case Transfer::ERROR:
-              ++n_failed;
-              break;
-
-            case Transfer::QUEUED:
-            case Transfer::CANCELED:
-            case Transfer::FINISHED:
-              break;
-          }
-      }
+    const auto& n = m_model->get_totals().n_in_state;
+    const int n_in_progress = n[Transfer::RUNNING] + n[Transfer::HASHING] + n[Transfer::PROCESSING];
+    const int n_paused = n[Transfer::PAUSED];
 
+    // errored transfers aren't shown, so they don't get the error icon
     const char * name;
     if (n_in_progress > 0)
       name = "transfer-progress";
     else if (n_paused > 0)
       name = "transfer-paused";
-    else if (n_failed > 0)
-      name = "transfer-error";
     else
       name = "transfer-none";
 
@@ -429,13 +432,10 @@ private:
      currently incomplete because they're either ongoing or paused. */
   bool header_should_be_visible() const
   {
-    for (auto it=m_visible_transfers.cbegin(); it!=m_visible_transfers.cend(); ++it)
-      {
-        auto transfer = m_model->get((*it).first);
-        if (transfer->state != Transfer::FINISHED)
-          return true;
-      }
-    return false;
+    // canceled and errored transfers aren't shown, so don't count them
+    const auto& n = m_model->get_totals().n_in_state;
+    return n[Transfer::QUEUED] + n[Transfer::RUNNING] + n[Transfer::PAUSED]
+         + n[Transfer::HASHING] + n[Transfer::PROCESSING] > 0;
   }
 
   GVariant* create_header_state()
@@ -514,35 +514,25 @@ private:
     return item;
   }
 
-  GMenuItem* get_next_bulk_action (GMenu* menu, Section section)
+  GMenuItem* get_next_bulk_action (Section section)
   {
     const char* label = nullptr;
     const char* extra_label = nullptr;
     const char* detailed_action = nullptr;
 
-    unsigned int n_can_pause = 0;
-    unsigned int n_can_resume = 0;
-    unsigned int n_can_clear = 0;
-    GMenuModel* mm = G_MENU_MODEL(menu);
-    for (int i=0, n=g_menu_model_get_n_items(mm); i<n; ++i)
-      {
-        gchar * uid = nullptr;
-        if (g_menu_model_get_item_attribute(mm, i, ATTRIBUTE_X_UID,
-                                            "s", &uid, nullptr))
-          {
-            std::shared_ptr<Transfer> t = m_model->get(uid);
-            g_free(uid);
-            if (!t)
-              continue;
-
-            if (t->can_pause())
-              ++n_can_pause;
-            if (t->can_resume())
-              ++n_can_resume;
-            if (t->can_clear())
-              ++n_can_clear;
-          }
-      }
+    // ONGOING holds the queued, running, paused, hashing and processing
+    // transfers and SUCCESSFUL holds the finished ones, so the model's
+    // per-state tallies say what the section's transfers can do
+    const auto& totals = m_model->get_totals();
+    const auto in_section = [section](const std::array<int,Transfer::ERROR+1>& n) -> int {
+      if (section == SUCCESSFUL)
+        return n[Transfer::FINISHED];
+      return n[Transfer::QUEUED] + n[Transfer::RUNNING] + n[Transfer::PAUSED]
+           + n[Transfer::HASHING] + n[Transfer::PROCESSING];
+    };
+    const int n_can_pause = in_section(totals.n_can_pause);
+    const int n_can_resume = in_section(totals.n_can_resume);
+    const int n_can_clear = in_section(totals.n_can_clear);
 
     if ((section == SUCCESSFUL) && (n_can_clear > 0))
       {
@@ -579,12 +569,28 @@ private:
         && menu_item_attribute_is_equal(model, pos, item, G_MENU_ATTRIBUTE_ACTION);
   }
 
+  void update_bulk_menu_items()
+  {
+    for (int i=0; i<NUM_SECTIONS; ++i)
+      {
+        if (!m_bulk_menu_item_dirty[i])
+          continue;
+
+        m_bulk_menu_item_dirty[i] = false;
+        auto mm = g_menu_model_get_item_link(G_MENU_MODEL(m_submenu),
+                                             i,
+                                             G_MENU_LINK_SECTION);
+        update_bulk_menu_item(G_MENU(mm), Section(i));
+        g_object_unref(mm);
+      }
+  }
+
   void update_bulk_menu_item(GMenu* menu, Section section)
   {
     GMenuModel* mm = G_MENU_MODEL(menu);
 
     // create a new item
-    auto item = get_next_bulk_action (menu, section);
+    auto item = get_next_bulk_action (section);
 
     // find the current item
     auto val = g_variant_new_string(BUTTON_SECTION);
@@ -613,7 +619,8 @@ private:
 
   static GMenuItem* create_transfer_menu_item(const std::shared_ptr<Transfer>& t)
   {
-    const auto& id = t->id.c_str();
+    const auto uid = t->id.str();
+    const auto id = uid.c_str();
 
     GMenuItem* menu_item;
 
@@ -632,8 +639,10 @@ private:
 
     g_menu_item_set_attribute (menu_item, ATTRIBUTE_X_TYPE,
                                "s", "com.canonical.indicator.transfer");
+    // Sources resolve app_icon off the main loop, so don't stat it here:
+    // it's either the full path of an existing file or a themed icon name
     GVariant * serialized_icon = nullptr;
-    if (!t->app_icon.empty() && g_file_test(t->app_icon.c_str(), G_FILE_TEST_EXISTS))
+    if (!t->app_icon.empty() && g_path_is_absolute(t->app_icon.c_str()))
       {
         auto file = g_file_new_for_path(t->app_icon.c_str());
         auto icon = g_file_icon_new(file);
@@ -641,6 +650,13 @@ private:
         g_clear_object(&icon);
         g_clear_object(&file);
       }
+    else if (!t->app_icon.empty())
+      {
+        const char* names[] = { t->app_icon.c_str(), "image-missing", nullptr };
+        auto icon = g_themed_icon_new_from_names(const_cast<char**>(names), -1);
+        serialized_icon = g_icon_serialize(icon);
+        g_clear_object(&icon);
+      }
     if (serialized_icon == nullptr)
       {
         auto icon = g_themed_icon_new("image-missing");
@@ -667,7 +683,7 @@ private:
                                          G_MENU_LINK_SECTION);
     gmenu = G_MENU(mm);
 
-    auto val = g_variant_new_string(id.c_str());
+    auto val = g_variant_new_string(id.str().c_str());
     pos = find_matching_menu_item(mm, ATTRIBUTE_X_UID, val);
     g_variant_unref(val);
   }
@@ -733,7 +749,7 @@ private:
       {
         m_visible_transfers.erase(id);
         g_menu_remove (cur_menu, cur_pos);
-        update_bulk_menu_item(cur_menu, cur_section);
+        m_bulk_menu_item_dirty[cur_section] = true;
       }
 
     if (new_menu != nullptr)
@@ -755,7 +771,7 @@ private:
 
         g_object_unref(item);
         m_visible_transfers[t->id] = new_section;
-        update_bulk_menu_item(new_menu, new_section);
+        m_bulk_menu_item_dirty[new_section] = true;
       }
 
     update_header_soon();
@@ -780,10 +796,32 @@ private:
 
     g_menu_remove(menu, pos);
     m_visible_transfers.erase(id);
-    update_bulk_menu_item(menu, section);
+    m_bulk_menu_item_dirty[section] = true;
     update_header_soon();
   }
 
+  // the fields that affect a transfer's menu item, section, and bulk actions.
+  // progress ticks don't touch any of these, so they're skipped entirely.
+  static constexpr Transfer::Fields MENU_FIELDS = Transfer::FIELD_STATE
+                                                | Transfer::FIELD_TITLE
+                                                | Transfer::FIELD_TOTAL_SIZE
+                                                | Transfer::FIELD_APP_ICON;
+
+  // handle a batch of changes in one pass,
+  // updating each section's bulk action menu item at most once
+  void update(const Model::Changes& changes)
+  {
+    for (const auto& id : changes.removed)
+      remove(id);
+    for (const auto& id : changes.added)
+      add(id);
+    for (const auto& it : changes.changed)
+      if (it.second & MENU_FIELDS)
+        update(it.first);
+
+    update_bulk_menu_items();
+  }
+
   /***
   ****
   ***/
@@ -794,8 +832,9 @@ private:
 
   std::shared_ptr<const Model> m_model;
   std::shared_ptr<GActions> m_gactions;
-  std::map<Transfer::Id,Section> m_visible_transfers;
+  std::unordered_map<Transfer::Id,Section> m_visible_transfers;
   GMenu* m_submenu = nullptr;
+  bool m_bulk_menu_item_dirty[NUM_SECTIONS] = {};
 
   guint m_update_header_tag = 0;
 
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "glib-fixture.h"
+
+#include "change-scheduler.h"
+
+#include <memory>
+#include <vector>
+
+using namespace unity::indicator::transfer;
+
+class ChangeSchedulerFixture: public GlibFixture
+{
+  typedef GlibFixture super;
+
+protected:
+
+  static constexpr unsigned int INTERVAL_MSEC {100};
+
+  std::shared_ptr<Pool> m_pool;
+  std::unique_ptr<ChangeScheduler> m_scheduler;
+  std::vector<std::vector<Transfer::Id>> m_flushes;
+
+  void SetUp() override
+  {
+    super::SetUp();
+
+    m_pool = std::make_shared<Pool>();
+    m_scheduler.reset(new ChangeScheduler(INTERVAL_MSEC, [this](const std::vector<Transfer::Id>& ids){
+      m_flushes.push_back(ids);
+    }, m_pool));
+  }
+
+  void TearDown() override
+  {
+    m_scheduler.reset();
+    m_pool.reset();
+
+    super::TearDown();
+  }
+};
+
+TEST_F(ChangeSchedulerFixture, CoalescesRepeatedMarks)
+{
+  for (int i=0; i<3; ++i)
+    {
+      m_scheduler->schedule(Transfer::Id("a"), ChangeScheduler::THROTTLED);
+      m_scheduler->schedule(Transfer::Id("b"), ChangeScheduler::THROTTLED);
+    }
+
+  // nothing's flushed before the interval's up
+  wait_msec(INTERVAL_MSEC/4);
+  EXPECT_TRUE(m_flushes.empty());
+
+  wait_msec(INTERVAL_MSEC*2);
+  ASSERT_EQ(1u, m_flushes.size());
+  EXPECT_EQ(std::vector<Transfer::Id>({Transfer::Id("a"), Transfer::Id("b")}), m_flushes[0]);
+
+  const auto& stats = m_scheduler->stats(ChangeScheduler::THROTTLED);
+  EXPECT_EQ(1u, stats.n_flushes);
+  EXPECT_EQ(2u, stats.n_changes);
+  EXPECT_EQ(0u, m_scheduler->stats(ChangeScheduler::URGENT).n_flushes);
+}
+
+TEST_F(ChangeSchedulerFixture, UrgentPreemptsThrottled)
+{
+  // an urgent mark takes a pending throttled change along with it...
+  m_scheduler->schedule(Transfer::Id("a"), ChangeScheduler::THROTTLED);
+  m_scheduler->schedule(Transfer::Id("b"), ChangeScheduler::THROTTLED);
+  m_scheduler->schedule(Transfer::Id("a"), ChangeScheduler::URGENT);
+
+  // ...and a throttled mark rides along with a pending urgent one
+  m_scheduler->schedule(Transfer::Id("c"), ChangeScheduler::URGENT);
+  m_scheduler->schedule(Transfer::Id("c"), ChangeScheduler::THROTTLED);
+
+  // the urgent lane flushes on the next idle
+  wait_msec(INTERVAL_MSEC/4);
+  ASSERT_EQ(1u, m_flushes.size());
+  EXPECT_EQ(std::vector<Transfer::Id>({Transfer::Id("a"), Transfer::Id("c")}), m_flushes[0]);
+
+  wait_msec(INTERVAL_MSEC*2);
+  ASSERT_EQ(2u, m_flushes.size());
+  EXPECT_EQ(std::vector<Transfer::Id>({Transfer::Id("b")}), m_flushes[1]);
+
+  EXPECT_EQ(2u, m_scheduler->stats(ChangeScheduler::URGENT).n_changes);
+  EXPECT_EQ(1u, m_scheduler->stats(ChangeScheduler::THROTTLED).n_changes);
+}
+
+TEST_F(ChangeSchedulerFixture, Unschedule)
+{
+  m_scheduler->schedule(Transfer::Id("a"), ChangeScheduler::URGENT);
+  m_scheduler->schedule(Transfer::Id("b"), ChangeScheduler::URGENT);
+  m_scheduler->schedule(Transfer::Id("c"), ChangeScheduler::THROTTLED);
+  m_scheduler->unschedule(Transfer::Id("a"));
+  m_scheduler->unschedule(Transfer::Id("c"));
+
+  wait_msec(INTERVAL_MSEC*2);
+  ASSERT_EQ(1u, m_flushes.size());
+  EXPECT_EQ(std::vector<Transfer::Id>({Transfer::Id("b")}), m_flushes[0]);
+
+  // a lane that was emptied doesn't flush at all
+  EXPECT_EQ(0u, m_scheduler->stats(ChangeScheduler::THROTTLED).n_flushes);
+}
+
+TEST_F(ChangeSchedulerFixture, RescheduleDuringFlush)
+{
+  // a flush that marks something dirty again gets another flush
+  int n_flushes = 0;
+  ChangeScheduler scheduler(INTERVAL_MSEC, [&](const std::vector<Transfer::Id>& ids){
+    if (++n_flushes == 1)
+      scheduler.schedule(ids.front(), ChangeScheduler::URGENT);
+  }, m_pool);
+
+  scheduler.schedule(Transfer::Id("a"), ChangeScheduler::URGENT);
+  wait_msec(INTERVAL_MSEC/4);
+  EXPECT_EQ(2, n_flushes);
+}
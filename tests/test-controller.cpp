@@ -84,14 +84,14 @@ TEST_F(ControllerFixture, ClearAll)
     bool can_clear;
     Transfer::Id id;
   } transfers[] = {
-    { Transfer::QUEUED, false, "queued" },
-    { Transfer::RUNNING, false, "running" },
-    { Transfer::PAUSED, false, "paused" },
-    { Transfer::CANCELED, false, "canceled" },
-    { Transfer::HASHING, false, "hashing" },
-    { Transfer::PROCESSING, false, "processing" },
-    { Transfer::FINISHED, true, "finished" },
-    { Transfer::ERROR, false, "error" }
+    { Transfer::QUEUED, false, Transfer::Id("queued") },
+    { Transfer::RUNNING, false, Transfer::Id("running") },
+    { Transfer::PAUSED, false, Transfer::Id("paused") },
+    { Transfer::CANCELED, false, Transfer::Id("canceled") },
+    { Transfer::HASHING, false, Transfer::Id("hashing") },
+    { Transfer::PROCESSING, false, Transfer::Id("processing") },
+    { Transfer::FINISHED, true, Transfer::Id("finished") },
+    { Transfer::ERROR, false, Transfer::Id("error") }
   };
 
   for (const auto& transfer : transfers)
@@ -134,14 +134,14 @@ TEST_F(ControllerFixture, PauseAll)
     bool can_pause;
     Transfer::Id id;
   } transfers[] = {
-    { Transfer::QUEUED, true, "queued" },
-    { Transfer::RUNNING, true, "running" },
-    { Transfer::PAUSED, false, "paused" },
-    { Transfer::CANCELED, false, "canceled" },
-    { Transfer::HASHING, true, "hashing" },
-    { Transfer::PROCESSING, true, "processing" },
-    { Transfer::FINISHED, false, "finished" },
-    { Transfer::ERROR, false, "error" }
+    { Transfer::QUEUED, true, Transfer::Id("queued") },
+    { Transfer::RUNNING, true, Transfer::Id("running") },
+    { Transfer::PAUSED, false, Transfer::Id("paused") },
+    { Transfer::CANCELED, false, Transfer::Id("canceled") },
+    { Transfer::HASHING, true, Transfer::Id("hashing") },
+    { Transfer::PROCESSING, true, Transfer::Id("processing") },
+    { Transfer::FINISHED, false, Transfer::Id("finished") },
+    { Transfer::ERROR, false, Transfer::Id("error") }
   };
 
   for (const auto& transfer : transfers)
@@ -167,14 +167,14 @@ TEST_F(ControllerFixture, ResumeAll)
     bool can_resume;
     Transfer::Id id;
   } transfers[] = {
-    { Transfer::QUEUED, false, "queued" },
-    { Transfer::RUNNING, false, "running" },
-    { Transfer::PAUSED, true, "paused" },
-    { Transfer::CANCELED, true, "canceled" },
-    { Transfer::HASHING, false, "hashing" },
-    { Transfer::PROCESSING, false, "processing" },
-    { Transfer::FINISHED, false, "finished" },
-    { Transfer::ERROR, true, "error" }
+    { Transfer::QUEUED, false, Transfer::Id("queued") },
+    { Transfer::RUNNING, false, Transfer::Id("running") },
+    { Transfer::PAUSED, true, Transfer::Id("paused") },
+    { Transfer::CANCELED, true, Transfer::Id("canceled") },
+    { Transfer::HASHING, false, Transfer::Id("hashing") },
+    { Transfer::PROCESSING, false, Transfer::Id("processing") },
+    { Transfer::FINISHED, false, Transfer::Id("finished") },
+    { Transfer::ERROR, true, Transfer::Id("error") }
   };
 
   for (const auto& transfer : transfers)
@@ -195,7 +195,7 @@ TEST_F(ControllerFixture, ResumeAll)
  */
 TEST_F(ControllerFixture, Tap)
 {
-  const Transfer::Id id = "id";
+  const Transfer::Id id("id");
 
   auto t = std::make_shared<Transfer>();
   t->state = Transfer::QUEUED;
@@ -269,7 +269,7 @@ TEST_F(ControllerFixture, Tap)
 
 TEST_F(ControllerFixture, Start)
 {
-  const Transfer::Id id = "id";
+  const Transfer::Id id("id");
   auto t = std::make_shared<Transfer>();
   t->id = id;
   t->state = Transfer::QUEUED;
@@ -289,7 +289,7 @@ TEST_F(ControllerFixture, Start)
 
 TEST_F(ControllerFixture, Pause)
 {
-  const Transfer::Id id = "id";
+  const Transfer::Id id("id");
   auto t = std::make_shared<Transfer>();
   t->id = id;
   t->state = Transfer::QUEUED;
@@ -309,7 +309,7 @@ TEST_F(ControllerFixture, Pause)
 
 TEST_F(ControllerFixture, Resume)
 {
-  const Transfer::Id id = "id";
+  const Transfer::Id id("id");
   auto t = std::make_shared<Transfer>();
   t->id = id;
   t->state = Transfer::QUEUED;
@@ -329,7 +329,7 @@ TEST_F(ControllerFixture, Resume)
 
 TEST_F(ControllerFixture, Cancel)
 {
-  const Transfer::Id id = "id";
+  const Transfer::Id id("id");
   auto t = std::make_shared<Transfer>();
   t->id = id;
   t->state = Transfer::QUEUED;
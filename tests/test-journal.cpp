@@ -0,0 +1,218 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "journal.h"
+
+#include <gtest/gtest.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+
+using namespace unity::indicator::transfer;
+
+class JournalFixture: public ::testing::Test
+{
+protected:
+
+  std::string m_dir;
+  std::string m_filename;
+
+  void SetUp() override
+  {
+    auto dir = g_dir_make_tmp("indicator-transfer-journal-XXXXXX", nullptr);
+    ASSERT_NE(nullptr, dir);
+    m_dir = dir;
+    g_free(dir);
+    m_filename = m_dir + "/test.journal";
+  }
+
+  void TearDown() override
+  {
+    g_remove(m_filename.c_str());
+    g_rmdir(m_dir.c_str());
+  }
+
+  static std::shared_ptr<Transfer> create_transfer(const std::string& id)
+  {
+    auto transfer = std::make_shared<Transfer>();
+    transfer->id = Transfer::Id(id);
+    transfer->state = Transfer::RUNNING;
+    transfer->seconds_left = 30;
+    transfer->time_started = 1234567;
+    transfer->progress = 0.25;
+    transfer->speed_Bps = 1000;
+    transfer->total_size = 40000;
+    transfer->title = "Title " + id;
+    transfer->app_icon = "/usr/share/icons/" + id + ".png";
+    return transfer;
+  }
+
+  static std::map<std::string,Journal::Entry> by_key(const std::vector<Journal::Entry>& entries)
+  {
+    std::map<std::string,Journal::Entry> map;
+    for (const auto& entry : entries)
+      map[entry.key] = entry;
+    return map;
+  }
+};
+
+TEST_F(JournalFixture, RoundTrip)
+{
+  auto a = create_transfer("1001");
+  auto b = create_transfer("/some/interned/id");
+  b->state = Transfer::ERROR;
+  b->set_error_string("Disk full");
+  auto c = create_transfer("1003");
+  c->state = Transfer::FINISHED;
+  c->set_local_path("/home/user/Downloads/c.zip");
+
+  {
+    Journal journal(m_filename);
+    ASSERT_TRUE(journal.is_open());
+    EXPECT_TRUE(journal.take_restored().empty());
+    journal.put(*a, "/ccad/a");
+    journal.put(*b, "/ccad/b");
+    journal.put(*c, "/ccad/c");
+    journal.remove(a->id);
+
+    const auto stats = journal.get_stats();
+    EXPECT_EQ(3u, stats.n_puts);
+    EXPECT_EQ(1u, stats.n_removes);
+    EXPECT_EQ(2u, stats.n_live);
+  }
+
+  Journal journal(m_filename);
+  auto restored = by_key(journal.take_restored());
+  ASSERT_EQ(2u, restored.size());
+  EXPECT_TRUE(journal.take_restored().empty());
+
+  const auto& rb = *restored["/ccad/b"].transfer;
+  EXPECT_EQ(b->id, rb.id);
+  EXPECT_EQ(Transfer::ERROR, rb.state);
+  EXPECT_EQ("Disk full", rb.error_string());
+  EXPECT_EQ(b->title, rb.title);
+  EXPECT_EQ(b->app_icon, rb.app_icon);
+
+  const auto& rc = *restored["/ccad/c"].transfer;
+  EXPECT_EQ(c->id, rc.id);
+  EXPECT_EQ(Transfer::FINISHED, rc.state);
+  EXPECT_EQ(c->local_path(), rc.local_path());
+  EXPECT_EQ(c->seconds_left, rc.seconds_left);
+  EXPECT_EQ(c->time_started, rc.time_started);
+  EXPECT_FLOAT_EQ(c->progress, rc.progress);
+  EXPECT_EQ(c->speed_Bps, rc.speed_Bps);
+  EXPECT_EQ(c->total_size, rc.total_size);
+  EXPECT_TRUE(rc.custom_state().empty());
+}
+
+TEST_F(JournalFixture, UnchangedPutsAreSkipped)
+{
+  Journal journal(m_filename);
+  auto a = create_transfer("1001");
+  journal.put(*a, "/ccad/a");
+  const auto used = journal.get_stats().bytes_used;
+
+  journal.put(*a, "/ccad/a");
+  EXPECT_EQ(1u, journal.get_stats().n_unchanged_puts);
+  EXPECT_EQ(used, journal.get_stats().bytes_used);
+
+  a->progress = 0.5;
+  journal.put(*a, "/ccad/a");
+  EXPECT_EQ(2u, journal.get_stats().n_puts);
+  EXPECT_LT(used, journal.get_stats().bytes_used);
+}
+
+TEST_F(JournalFixture, GrowsAndCompacts)
+{
+  // enough churn to outgrow the initial mapping
+  auto a = create_transfer("1001");
+  auto b = create_transfer("1002");
+  a->title = std::string(1000, 'a');
+  {
+    Journal journal(m_filename);
+    for (int i=1; i<=1000; ++i)
+      {
+        a->speed_Bps = i;
+        journal.put(*a, "/ccad/a");
+      }
+    journal.put(*b, "/ccad/b");
+    auto stats = journal.get_stats();
+    EXPECT_LT(size_t(1000*1000), stats.bytes_used);
+    EXPECT_LE(stats.bytes_used, stats.bytes_mapped);
+
+    journal.compact();
+    stats = journal.get_stats();
+    EXPECT_EQ(1u, stats.n_compactions);
+    EXPECT_GT(size_t(4000), stats.bytes_used);
+
+    // it keeps working after it's compacted
+    b->state = Transfer::PAUSED;
+    journal.put(*b, "/ccad/b");
+  }
+
+  Journal journal(m_filename);
+  auto restored = by_key(journal.take_restored());
+  ASSERT_EQ(2u, restored.size());
+  EXPECT_EQ(1000u, restored["/ccad/a"].transfer->speed_Bps);
+  EXPECT_EQ(a->title, restored["/ccad/a"].transfer->title);
+  EXPECT_EQ(Transfer::PAUSED, restored["/ccad/b"].transfer->state);
+}
+
+TEST_F(JournalFixture, DiscardsUnreadableFiles)
+{
+  {
+    std::ofstream out(m_filename);
+    out << "this isn't a journal";
+  }
+
+  Journal journal(m_filename);
+  EXPECT_TRUE(journal.is_open());
+  EXPECT_TRUE(journal.take_restored().empty());
+
+  journal.put(*create_transfer("1001"), "/ccad/a");
+  EXPECT_EQ(1u, journal.get_stats().n_live);
+}
+
+TEST_F(JournalFixture, IgnoresTornRecords)
+{
+  {
+    Journal journal(m_filename);
+    journal.put(*create_transfer("1001"), "/ccad/a");
+    journal.put(*create_transfer("1002"), "/ccad/b");
+  }
+
+  // a crash mid-append would leave a record past the end, which is fine,
+  // but an end that's past a partial record mustn't be trusted either
+  {
+    std::fstream file(m_filename, std::ios::in|std::ios::out|std::ios::binary);
+    uint64_t end;
+    file.seekg(8);
+    file.read(reinterpret_cast<char*>(&end), sizeof(end));
+    end -= 10;
+    file.seekp(8);
+    file.write(reinterpret_cast<const char*>(&end), sizeof(end));
+  }
+
+  Journal journal(m_filename);
+  auto restored = by_key(journal.take_restored());
+  ASSERT_EQ(1u, restored.size());
+  EXPECT_EQ(Transfer::Id("1001"), restored["/ccad/a"].transfer->id);
+}
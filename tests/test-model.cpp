@@ -0,0 +1,901 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <transfer/model.h>
+
+#include <gtest/gtest.h>
+
+#include <glib.h>
+
+#include <malloc.h> // mallinfo()
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace unity::indicator::transfer;
+
+namespace
+{
+  std::shared_ptr<Transfer> create_transfer(const Transfer::Id& id)
+  {
+    auto transfer = std::make_shared<Transfer>();
+    transfer->id = id;
+    return transfer;
+  }
+
+  std::shared_ptr<Transfer> create_transfer(const std::string& id)
+  {
+    return create_transfer(Transfer::Id(id));
+  }
+
+  std::vector<std::shared_ptr<Transfer>> create_transfers(int n)
+  {
+    std::vector<std::shared_ptr<Transfer>> transfers;
+    for (int i=0; i<n; ++i)
+      transfers.push_back(create_transfer("/com/canonical/applications/download/" + std::to_string(i)));
+    return transfers;
+  }
+}
+
+TEST(Model, AddGetRemove)
+{
+  MutableModel model;
+  EXPECT_EQ(0, model.size());
+  EXPECT_FALSE(model.get(Transfer::Id("a")));
+  EXPECT_EQ(Model::INVALID_HANDLE, model.get_handle(Transfer::Id("a")));
+
+  auto a = create_transfer("a");
+  auto b = create_transfer("b");
+  model.add(a);
+  model.add(b);
+  EXPECT_EQ(2, model.size());
+  EXPECT_EQ(a, model.get(Transfer::Id("a")));
+  EXPECT_EQ(b, model.get(Transfer::Id("b")));
+  EXPECT_EQ(1, model.count(Transfer::Id("a")));
+  EXPECT_EQ(0, model.count(Transfer::Id("c")));
+  EXPECT_EQ(std::set<Transfer::Id>({Transfer::Id("a"), Transfer::Id("b")}), model.get_ids());
+
+  model.remove(Transfer::Id("a"));
+  EXPECT_EQ(1, model.size());
+  EXPECT_FALSE(model.get(Transfer::Id("a")));
+  EXPECT_EQ(b, model.get(Transfer::Id("b")));
+  EXPECT_EQ(std::vector<std::shared_ptr<Transfer>>({b}), model.get_all());
+}
+
+TEST(Model, AddReplacesSameId)
+{
+  MutableModel model;
+  auto a1 = create_transfer("a");
+  auto a2 = create_transfer("a");
+
+  model.add(a1);
+  const auto handle = model.get_handle(Transfer::Id("a"));
+  model.add(a2);
+
+  EXPECT_EQ(1, model.size());
+  EXPECT_EQ(a2, model.get(Transfer::Id("a")));
+  EXPECT_EQ(handle, model.get_handle(Transfer::Id("a")));
+}
+
+TEST(Model, HandlesAreStable)
+{
+  constexpr int n {1000};
+  MutableModel model;
+  auto transfers = create_transfers(n);
+
+  std::vector<Model::Handle> handles;
+  for (const auto& transfer : transfers)
+    {
+      model.add(transfer);
+      handles.push_back(model.get_handle(transfer->id));
+    }
+
+  // removing half of them, and growing and shrinking the index,
+  // must not change the handles of the others
+  for (int i=1; i<n; i+=2)
+    model.remove(transfers[i]->id);
+  for (int i=0; i<n; i+=2)
+    {
+      EXPECT_EQ(handles[i], model.get_handle(transfers[i]->id));
+      EXPECT_EQ(transfers[i], model.get_by_handle(handles[i]));
+    }
+  for (int i=1; i<n; i+=2)
+    EXPECT_FALSE(model.get_by_handle(handles[i]));
+
+  EXPECT_FALSE(model.get_by_handle(Model::INVALID_HANDLE));
+}
+
+TEST(Model, SignalsSeeTheTransfer)
+{
+  MutableModel model;
+  auto a = create_transfer("a");
+
+  int n_added = 0;
+  int n_removed = 0;
+  model.added().connect([&model,&a,&n_added](const Transfer::Id& id){
+    EXPECT_EQ(a, model.get(id));
+    ++n_added;
+  });
+  model.removed().connect([&model,&a,&n_removed](const Transfer::Id& id){
+    EXPECT_EQ(a, model.get(id));
+    ++n_removed;
+  });
+
+  model.add(a);
+  // 'id' is a reference into the transfer being removed
+  model.remove(a->id);
+  a.reset();
+
+  EXPECT_EQ(1, n_added);
+  EXPECT_EQ(1, n_removed);
+  EXPECT_EQ(0, model.size());
+}
+
+TEST(Model, ForEach)
+{
+  MutableModel model;
+  auto transfers = create_transfers(100);
+  for (const auto& transfer : transfers)
+    model.add(transfer);
+  model.remove(transfers[10]->id);
+
+  std::set<Transfer::Id> visited;
+  model.for_each([&visited](const Transfer& transfer){visited.insert(transfer.id);});
+  EXPECT_EQ(model.get_ids(), visited);
+}
+
+TEST(Model, ForEachRemovesDuringWalk)
+{
+  MutableModel model;
+  auto transfers = create_transfers(100);
+  for (const auto& transfer : transfers)
+    model.add(transfer);
+  std::weak_ptr<Transfer> weak = transfers[0];
+  transfers.clear();
+
+  // remove each transfer as it's visited, and also remove one not yet visited
+  std::set<Transfer::Id> visited;
+  Transfer::Id skipped;
+  model.for_each([&](Transfer& transfer){
+    visited.insert(transfer.id);
+    model.remove(transfer.id);
+    EXPECT_FALSE(transfer.id.empty()); // still alive
+    if (skipped.empty() && model.size())
+      {
+        model.for_each([&skipped](const Transfer& t){if (skipped.empty()) skipped=t.id;});
+        model.remove(skipped);
+      }
+  });
+
+  EXPECT_EQ(0, model.size());
+  EXPECT_EQ(99u, visited.size());
+  EXPECT_FALSE(visited.count(skipped));
+  EXPECT_TRUE(weak.expired()); // the graveyard was emptied
+}
+
+TEST(Model, ForEachAddsDuringWalk)
+{
+  MutableModel model;
+  auto transfers = create_transfers(20);
+  for (int i=0; i<10; ++i)
+    model.add(transfers[i]);
+  model.remove(transfers[0]->id); // leave a free slot before the walk
+
+  int n_visited = 0;
+  int i = 10;
+  model.for_each([&](const Transfer&){
+    ++n_visited;
+    model.add(transfers[i++]);
+  });
+
+  EXPECT_EQ(9, n_visited);
+  EXPECT_EQ(18, model.size());
+}
+
+TEST(Model, ForEachReplacesDuringWalk)
+{
+  MutableModel model;
+  auto transfers = create_transfers(10);
+  for (const auto& transfer : transfers)
+    model.add(transfer);
+  std::vector<std::weak_ptr<Transfer>> weak(transfers.begin(), transfers.end());
+  transfers.clear();
+
+  // re-add each transfer's id as it's visited
+  int n_visited = 0;
+  model.for_each([&](const Transfer& transfer){
+    ++n_visited;
+    std::weak_ptr<Transfer> old = model.get(transfer.id);
+    model.add(create_transfer(transfer.id));
+    EXPECT_FALSE(old.expired()); // still alive
+    EXPECT_FALSE(transfer.id.empty());
+  });
+
+  EXPECT_EQ(10, n_visited);
+  EXPECT_EQ(10, model.size());
+  for (const auto& w : weak)
+    EXPECT_TRUE(w.expired()); // the graveyard was emptied
+}
+
+TEST(Model, ChangesOutsideBatchAreEmittedAtOnce)
+{
+  MutableModel model;
+  std::vector<Model::Changes> batches;
+  model.batch().connect([&batches](const Model::Changes& changes){batches.push_back(changes);});
+
+  auto a = create_transfer("a");
+  model.add(a);
+  model.emit_changed(Transfer::Id("a"));
+  model.remove(Transfer::Id("a"));
+
+  ASSERT_EQ(3u, batches.size());
+  EXPECT_EQ(std::set<Transfer::Id>({Transfer::Id("a")}), batches[0].added);
+  EXPECT_EQ(1u, batches[1].changed.size());
+  EXPECT_EQ(Transfer::ALL_FIELDS, batches[1].changed[Transfer::Id("a")]);
+  EXPECT_EQ(std::set<Transfer::Id>({Transfer::Id("a")}), batches[2].removed);
+}
+
+TEST(Model, BatchDeduplicates)
+{
+  MutableModel model;
+  auto transfers = create_transfers(4);
+  model.add(transfers[0]);
+  model.add(transfers[1]);
+  const auto& id0 = transfers[0]->id;
+  const auto& id1 = transfers[1]->id;
+  const auto& id2 = transfers[2]->id;
+  const auto& id3 = transfers[3]->id;
+
+  std::vector<Model::Changes> batches;
+  model.batch().connect([&batches](const Model::Changes& changes){batches.push_back(changes);});
+  int n_changed = 0;
+  model.changed().connect([&n_changed](const Transfer::Id&){++n_changed;});
+
+  model.begin_batch();
+  model.begin_batch();
+  for (int i=0; i<100; ++i)
+    model.emit_changed(id0);   // changed many times -> changed once
+  model.add(transfers[2]);
+  model.emit_changed(id2);     // added, then changed -> added
+  model.add(transfers[3]);
+  model.remove(id3);           // added, then removed -> nothing
+  model.emit_changed(id1);
+  model.remove(id1);           // changed, then removed -> removed
+  model.end_batch();
+  EXPECT_TRUE(batches.empty()); // still inside the outer batch
+  model.end_batch();
+
+  EXPECT_EQ(102, n_changed);    // the per-id signals still fire right away
+  ASSERT_EQ(1u, batches.size());
+  EXPECT_EQ(std::set<Transfer::Id>({id2}), batches[0].added);
+  EXPECT_EQ(1u, batches[0].changed.size());
+  EXPECT_EQ(1u, batches[0].changed.count(id0));
+  EXPECT_EQ(std::set<Transfer::Id>({id1}), batches[0].removed);
+}
+
+TEST(Model, BatchMergesChangedFields)
+{
+  MutableModel model;
+  model.add(create_transfer("a"));
+  model.add(create_transfer("b"));
+
+  std::vector<Model::Changes> batches;
+  model.batch().connect([&batches](const Model::Changes& changes){batches.push_back(changes);});
+
+  model.begin_batch();
+  model.emit_changed(Transfer::Id("a"), Transfer::FIELD_PROGRESS);
+  model.emit_changed(Transfer::Id("a"), Transfer::FIELD_SPEED);
+  model.emit_changed(Transfer::Id("b"), Transfer::FIELD_STATE);
+  model.end_batch();
+
+  ASSERT_EQ(1u, batches.size());
+  auto& changed = batches[0].changed;
+  EXPECT_EQ(2u, changed.size());
+  EXPECT_EQ(Transfer::Fields(Transfer::FIELD_PROGRESS|Transfer::FIELD_SPEED), changed[Transfer::Id("a")]);
+  EXPECT_EQ(Transfer::Fields(Transfer::FIELD_STATE), changed[Transfer::Id("b")]);
+}
+
+TEST(Model, BatchReplacement)
+{
+  MutableModel model;
+  model.add(create_transfer("a"));
+
+  std::vector<Model::Changes> batches;
+  model.batch().connect([&batches](const Model::Changes& changes){batches.push_back(changes);});
+
+  // removing a transfer and adding a new one with the same id
+  // must be reported as both, so listeners drop the stale transfer
+  model.begin_batch();
+  model.remove(Transfer::Id("a"));
+  model.add(create_transfer("a"));
+  model.emit_changed(Transfer::Id("a"));
+  model.end_batch();
+
+  ASSERT_EQ(1u, batches.size());
+  EXPECT_EQ(std::set<Transfer::Id>({Transfer::Id("a")}), batches[0].removed);
+  EXPECT_EQ(std::set<Transfer::Id>({Transfer::Id("a")}), batches[0].added);
+  EXPECT_TRUE(batches[0].changed.empty());
+}
+
+TEST(Model, Generations)
+{
+  MutableModel model;
+  EXPECT_EQ(0u, model.generation());
+  EXPECT_EQ(0u, model.get_generation(Transfer::Id("a")));
+
+  model.add(create_transfer("a"));
+  model.add(create_transfer("b"));
+  model.add(create_transfer("c"));
+  const auto gen = model.generation();
+  EXPECT_EQ(gen, model.get_generation(Transfer::Id("c")));
+
+  Model::Changes changes;
+  ASSERT_TRUE(model.changes_since(gen, changes));
+  EXPECT_TRUE(changes.empty());
+
+  model.emit_changed(Transfer::Id("a"));
+  model.remove(Transfer::Id("b"));
+  model.add(create_transfer("c")); // replaced
+  model.add(create_transfer("d"));
+  model.add(create_transfer("e"));
+  model.remove(Transfer::Id("e"));               // came and went
+  EXPECT_LT(gen, model.get_generation(Transfer::Id("a")));
+
+  ASSERT_TRUE(model.changes_since(gen, changes));
+  EXPECT_EQ(std::set<Transfer::Id>({Transfer::Id("c"), Transfer::Id("d")}), changes.added);
+  EXPECT_EQ(1u, changes.changed.size());
+  EXPECT_EQ(Transfer::ALL_FIELDS, changes.changed[Transfer::Id("a")]);
+  EXPECT_EQ(std::set<Transfer::Id>({Transfer::Id("b"), Transfer::Id("c")}), changes.removed);
+
+  ASSERT_TRUE(model.changes_since(0, changes));
+  EXPECT_EQ(std::set<Transfer::Id>({Transfer::Id("a"), Transfer::Id("c"), Transfer::Id("d")}), changes.added);
+  EXPECT_TRUE(changes.changed.empty());
+  EXPECT_TRUE(changes.removed.empty());
+
+  // a generation from the future can't be answered
+  EXPECT_FALSE(model.changes_since(model.generation()+1, changes));
+}
+
+TEST(Model, GenerationsForgetOldRemovals)
+{
+  MutableModel model;
+  const auto gen = model.generation();
+
+  // after enough removals, old generations can't be answered
+  for (const auto& transfer : create_transfers(5000))
+    {
+      model.add(transfer);
+      model.remove(transfer->id);
+    }
+
+  Model::Changes changes;
+  EXPECT_FALSE(model.changes_since(gen, changes));
+  EXPECT_TRUE(model.changes_since(model.generation(), changes));
+  EXPECT_TRUE(changes.empty());
+}
+
+TEST(Model, Totals)
+{
+  MutableModel model;
+  const auto& totals = model.get_totals();
+  EXPECT_EQ(0, totals.n_in_state[Transfer::QUEUED]);
+  EXPECT_EQ(-1, totals.seconds_left());
+
+  auto a = create_transfer("a");
+  a->state = Transfer::RUNNING;
+  a->total_size = 1000;
+  a->progress = 0.5;
+  a->speed_Bps = 100;
+  model.add(a);
+
+  auto b = create_transfer("b");
+  b->state = Transfer::FINISHED;
+  b->total_size = 300;
+  b->progress = 1.0;
+  model.add(b);
+
+  EXPECT_EQ(1, totals.n_in_state[Transfer::RUNNING]);
+  EXPECT_EQ(1, totals.n_in_state[Transfer::FINISHED]);
+  EXPECT_EQ(1300u, totals.total_size);
+  EXPECT_EQ(800u, totals.received);
+  EXPECT_EQ(100u, totals.speed_Bps);
+  EXPECT_EQ(500u, totals.remaining);
+  EXPECT_EQ(5, totals.seconds_left());
+
+  // changes are picked up when they're emitted
+  a->state = Transfer::PAUSED;
+  a->speed_Bps = 0;
+  EXPECT_EQ(1, totals.n_in_state[Transfer::RUNNING]);
+  model.emit_changed(Transfer::Id("a"));
+  EXPECT_EQ(0, totals.n_in_state[Transfer::RUNNING]);
+  EXPECT_EQ(1, totals.n_in_state[Transfer::PAUSED]);
+  EXPECT_EQ(0u, totals.speed_Bps);
+  EXPECT_EQ(-1, totals.seconds_left());
+
+  // replacing a transfer replaces its tally
+  auto a2 = create_transfer("a");
+  a2->state = Transfer::ERROR;
+  a2->total_size = 50;
+  model.add(a2);
+  EXPECT_EQ(0, totals.n_in_state[Transfer::PAUSED]);
+  EXPECT_EQ(1, totals.n_in_state[Transfer::ERROR]);
+  EXPECT_EQ(350u, totals.total_size);
+  EXPECT_EQ(300u, totals.received);
+  EXPECT_EQ(0u, totals.remaining);
+
+  // the can_*() tallies come from the transfers, not from their states
+  EXPECT_EQ(1, totals.n_can_resume[Transfer::ERROR]);
+  EXPECT_EQ(1, totals.n_can_clear[Transfer::FINISHED]);
+  struct Unresumable: public Transfer
+  {
+    bool can_resume() const override {return false;}
+  };
+  auto a3 = std::make_shared<Unresumable>();
+  a3->id = Transfer::Id("a");
+  a3->state = Transfer::ERROR;
+  model.add(a3);
+  EXPECT_EQ(1, totals.n_in_state[Transfer::ERROR]);
+  EXPECT_EQ(0, totals.n_can_resume[Transfer::ERROR]);
+
+  model.remove(Transfer::Id("a"));
+  model.remove(Transfer::Id("b"));
+  EXPECT_EQ(0, totals.n_can_clear[Transfer::FINISHED]);
+  EXPECT_EQ(0, totals.n_in_state[Transfer::ERROR]);
+  EXPECT_EQ(0, totals.n_in_state[Transfer::FINISHED]);
+  EXPECT_EQ(0u, totals.total_size);
+  EXPECT_EQ(0u, totals.received);
+}
+
+TEST(Model, Retention)
+{
+  MutableModel model;
+
+  // nothing's evicted until there's a policy
+  std::vector<std::shared_ptr<Transfer>> finished;
+  for (const auto& id : {"a", "b", "c", "d"})
+    {
+      auto transfer = create_transfer(id);
+      transfer->state = Transfer::FINISHED;
+      model.add(transfer);
+      finished.push_back(transfer);
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+  auto running = create_transfer("e");
+  running->state = Transfer::RUNNING;
+  model.add(running);
+  EXPECT_TRUE(model.prune().empty());
+  EXPECT_EQ(0u, model.get_retention_stats().n_prunes);
+
+  int n_batches = 0;
+  std::set<Transfer::Id> removed;
+  model.batch().connect([&n_batches, &removed](const Model::Changes& changes){
+    ++n_batches;
+    removed.insert(changes.removed.begin(), changes.removed.end());
+  });
+
+  // the oldest retired transfers go first, in one batch
+  MutableModel::RetentionPolicy policy;
+  policy.max_count = 2;
+  model.set_retention_policy(policy);
+  auto evicted = model.prune();
+  ASSERT_EQ(2u, evicted.size());
+  EXPECT_EQ(finished[0], evicted[0]);
+  EXPECT_EQ(finished[1], evicted[1]);
+  EXPECT_EQ(1, n_batches);
+  EXPECT_EQ(std::set<Transfer::Id>({Transfer::Id("a"), Transfer::Id("b")}), removed);
+  EXPECT_EQ(std::set<Transfer::Id>({Transfer::Id("c"), Transfer::Id("d"), Transfer::Id("e")}), model.get_ids());
+  EXPECT_EQ(2u, model.get_retention_stats().n_evicted_for_count);
+
+  // within budget, pruning doesn't even scan
+  const auto n_prunes = model.get_retention_stats().n_prunes;
+  EXPECT_TRUE(model.prune().empty());
+  EXPECT_EQ(n_prunes, model.get_retention_stats().n_prunes);
+
+  // a transfer retires when a change to its state is emitted
+  running->state = Transfer::ERROR;
+  model.emit_changed(running->id);
+  evicted = model.prune();
+  ASSERT_EQ(1u, evicted.size());
+  EXPECT_EQ(finished[2], evicted[0]);
+
+  // ...and is no longer retired if it's restarted
+  running->state = Transfer::RUNNING;
+  model.emit_changed(running->id);
+
+  // age
+  policy = MutableModel::RetentionPolicy();
+  policy.max_age_sec = 60;
+  model.set_retention_policy(policy);
+  EXPECT_TRUE(model.prune().empty());
+  EXPECT_TRUE(model.prune_expired().empty());
+  evicted = model.prune_expired(g_get_monotonic_time() + 61*G_USEC_PER_SEC);
+  ASSERT_EQ(1u, evicted.size());
+  EXPECT_EQ(finished[3], evicted[0]);
+  EXPECT_EQ(1u, model.get_retention_stats().n_evicted_for_age);
+  EXPECT_EQ(std::set<Transfer::Id>({Transfer::Id("e")}), model.get_ids());
+
+  // memory budget, which counts active transfers but never evicts them
+  for (const auto& id : {"f", "g"})
+    {
+      auto transfer = create_transfer(id);
+      transfer->state = Transfer::CANCELED;
+      transfer->title = std::string(1000, 'x');
+      model.add(transfer);
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+  policy = MutableModel::RetentionPolicy();
+  policy.max_bytes = 1;
+  model.set_retention_policy(policy);
+  evicted = model.prune();
+  EXPECT_EQ(2u, evicted.size());
+  EXPECT_EQ(2u, model.get_retention_stats().n_evicted_for_bytes);
+  EXPECT_EQ(std::set<Transfer::Id>({Transfer::Id("e")}), model.get_ids());
+}
+
+TEST(Model, Snapshots)
+{
+  MutableModel model;
+  const auto empty = model.snapshot();
+  EXPECT_EQ(0, empty->size());
+  EXPECT_EQ(0u, empty->generation());
+
+  // snapshots are built lazily, when they're asked for
+  for (int i=1; i<=200; ++i)
+    {
+      auto transfer = create_transfer(std::to_string(i));
+      transfer->total_size = i;
+      model.add(transfer);
+    }
+  const auto before = model.snapshot();
+  EXPECT_EQ(200, before->size());
+  EXPECT_EQ(model.generation(), before->generation());
+  EXPECT_EQ(model.get_totals().total_size, before->get_totals().total_size);
+  EXPECT_EQ(0, empty->size());
+
+  // a snapshot holds copies, so changing a transfer doesn't change it
+  auto a = model.get(Transfer::Id("1"));
+  a->total_size = 1000;
+  a->state = Transfer::RUNNING;
+  EXPECT_EQ(1u, before->get(Transfer::Id("1"))->total_size);
+  EXPECT_EQ(before, model.snapshot());
+
+  // ...until the change is emitted, which publishes a new one
+  model.begin_batch();
+  model.emit_changed(a->id, Transfer::FIELD_STATE|Transfer::FIELD_TOTAL_SIZE);
+  model.remove(Transfer::Id("200"));
+  EXPECT_EQ(before, model.snapshot());
+  model.end_batch();
+  const auto after = model.snapshot();
+  EXPECT_NE(before, after);
+  EXPECT_EQ(199, after->size());
+  EXPECT_EQ(1000u, after->get(Transfer::Id("1"))->total_size);
+  EXPECT_EQ(Transfer::RUNNING, after->get(Transfer::Id("1"))->state);
+  EXPECT_FALSE(after->get(Transfer::Id("200")));
+  EXPECT_EQ(1u, before->get(Transfer::Id("1"))->total_size);
+  EXPECT_TRUE(before->get(Transfer::Id("200")));
+
+  // untouched transfers are shared, not copied
+  EXPECT_EQ(before->get(Transfer::Id("100")), after->get(Transfer::Id("100")));
+  EXPECT_NE(before->get(Transfer::Id("1")), after->get(Transfer::Id("1")));
+
+  uint64_t total_size = 0;
+  after->for_each([&total_size](const Transfer& t){total_size += t.total_size;});
+  EXPECT_EQ(after->get_totals().total_size, total_size);
+  EXPECT_EQ(199u, after->get_all().size());
+
+  // lookups probe the snapshot's own copy of the index
+  for (int i=1; i<200; ++i)
+    {
+      const Transfer::Id id(std::to_string(i));
+      ASSERT_TRUE(after->get(id));
+      EXPECT_EQ(std::to_string(i), after->get(id)->id.str());
+    }
+  EXPECT_FALSE(after->get(Transfer::Id::find("nope")));
+
+  // other threads don't build snapshots; they get the last one that was built...
+  model.remove(Transfer::Id("199"));
+  std::shared_ptr<const Model::Snapshot> from_thread;
+  std::thread([&model, &from_thread](){from_thread = model.snapshot();}).join();
+  EXPECT_EQ(after, from_thread);
+
+  // ...and the model's thread builds the next one for them when it's idle
+  while (g_main_context_iteration(nullptr, false)) {}
+  std::thread([&model, &from_thread](){from_thread = model.snapshot();}).join();
+  EXPECT_EQ(198, from_thread->size());
+  EXPECT_EQ(from_thread, model.snapshot());
+
+  // ...or when its next batch ends, if that comes first
+  model.remove(Transfer::Id("198"));
+  std::thread([&model, &from_thread](){from_thread = model.snapshot();}).join();
+  EXPECT_EQ(197, from_thread->size());
+}
+
+TEST(Model, SnapshotsAcrossThreads)
+{
+  MutableModel model;
+  std::vector<std::shared_ptr<Transfer>> transfers;
+  for (int i=1; i<=100; ++i)
+    {
+      auto transfer = create_transfer(std::to_string(i));
+      model.add(transfer);
+      transfers.push_back(transfer);
+    }
+
+  // every snapshot is consistent with its own totals
+  std::atomic<bool> done {false};
+  std::atomic<int> n_reads {0};
+  std::thread reader([&](){
+    while (!done)
+      {
+        const auto snapshot = model.snapshot();
+        uint64_t total_size = 0;
+        snapshot->for_each([&total_size](const Transfer& t){total_size += t.total_size;});
+        EXPECT_EQ(snapshot->get_totals().total_size, total_size);
+        ++n_reads;
+      }
+  });
+
+  for (int pass=0; pass<100; ++pass)
+    {
+      model.begin_batch();
+      for (auto& transfer : transfers)
+        {
+          transfer->total_size += 10;
+          model.emit_changed(transfer->id, Transfer::FIELD_TOTAL_SIZE);
+        }
+      model.end_batch();
+    }
+  while (n_reads < 10)
+    std::this_thread::yield();
+  done = true;
+  reader.join();
+
+  EXPECT_EQ(100u*100u*10u, model.snapshot()->get_totals().total_size);
+}
+
+TEST(Model, Columns)
+{
+  // churn the model's states and confirm that the
+  // kernels agree with the totals and with a walk
+  auto transfers = create_transfers(300);
+  MutableModel model;
+  uint32_t seed = 1;
+  for (int i=0; i<3000; ++i)
+    {
+      seed = seed * 1103515245 + 12345;
+      const auto& transfer = transfers[(seed >> 16) % transfers.size()];
+      transfer->state = Transfer::State((seed >> 8) % (Transfer::ERROR+1));
+      transfer->speed_Bps = (seed >> 4) % 1000;
+      if (!model.count(transfer->id))
+        model.add(transfer);
+      else if (i % 5)
+        model.emit_changed(transfer->id);
+      else
+        model.remove(transfer->id);
+    }
+
+  std::array<int,Transfer::ERROR+1> expected {};
+  uint64_t expected_speed = 0;
+  model.for_each([&](const Transfer& t){++expected[t.state]; expected_speed += t.speed_Bps;});
+
+  EXPECT_EQ(expected, model.count_by_state());
+  EXPECT_EQ(expected, model.get_totals().n_in_state);
+  EXPECT_EQ(expected_speed, model.sum_speed());
+  EXPECT_EQ(expected_speed, model.get_totals().speed_Bps);
+
+  const auto mask = Model::state_bit(Transfer::RUNNING) | Model::state_bit(Transfer::PAUSED);
+  EXPECT_EQ(expected[Transfer::RUNNING] + expected[Transfer::PAUSED], model.count_in_states(mask));
+  EXPECT_EQ(expected[Transfer::FINISHED] > 0, model.any_in_states(Model::state_bit(Transfer::FINISHED)));
+
+  for (const auto& transfer : transfers)
+    if (model.count(transfer->id))
+      model.remove(transfer->id);
+  EXPECT_FALSE(model.any_in_states(~Model::StateMask(0) >> 1));
+  EXPECT_EQ(0, model.count_in_states(~Model::StateMask(0) >> 1));
+}
+
+TEST(Model, MatchesMap)
+{
+  // churn the model with a repeatable mix of adds and removes
+  // and confirm that it agrees with a std::map at every step
+  constexpr int n_ids {500};
+  constexpr int n_ops {20000};
+  auto transfers = create_transfers(n_ids);
+
+  MutableModel model;
+  std::map<Transfer::Id,std::shared_ptr<Transfer>> expected;
+  uint32_t seed = 1;
+  for (int i=0; i<n_ops; ++i)
+    {
+      seed = seed * 1103515245 + 12345;
+      const auto& transfer = transfers[(seed >> 16) % n_ids];
+      if (expected.count(transfer->id))
+        {
+          model.remove(transfer->id);
+          expected.erase(transfer->id);
+        }
+      else
+        {
+          model.add(transfer);
+          expected[transfer->id] = transfer;
+        }
+
+      ASSERT_EQ(int(expected.size()), model.size());
+      ASSERT_EQ(bool(expected.count(transfer->id)), bool(model.get(transfer->id)));
+    }
+
+  for (const auto& transfer : transfers)
+    EXPECT_EQ(expected.count(transfer->id) ? transfer : nullptr, model.get(transfer->id));
+
+  std::set<Transfer::Id> expected_ids;
+  for (const auto& it : expected)
+    expected_ids.insert(it.first);
+  EXPECT_EQ(expected_ids, model.get_ids());
+}
+
+TEST(Model, DISABLED_Benchmark)
+{
+  for (const int n : {10, 1000, 100000})
+    {
+      const int n_lookups = std::max(1000000, n);
+      auto transfers = create_transfers(n);
+
+      // baseline: the std::map that Model used before
+      std::map<Transfer::Id,std::shared_ptr<Transfer>> map;
+      auto begin = g_get_monotonic_time();
+      for (const auto& transfer : transfers)
+        map[transfer->id] = transfer;
+      const auto map_add_usec = g_get_monotonic_time() - begin;
+
+      size_t found = 0;
+      begin = g_get_monotonic_time();
+      for (int i=0; i<n_lookups; ++i)
+        found += map.find(transfers[i % n]->id) != map.end();
+      const auto map_get_usec = g_get_monotonic_time() - begin;
+      EXPECT_EQ(size_t(n_lookups), found);
+
+      MutableModel model;
+      begin = g_get_monotonic_time();
+      for (const auto& transfer : transfers)
+        model.add(transfer);
+      const auto model_add_usec = g_get_monotonic_time() - begin;
+
+      found = 0;
+      begin = g_get_monotonic_time();
+      for (int i=0; i<n_lookups; ++i)
+        found += model.get_handle(transfers[i % n]->id) != Model::INVALID_HANDLE;
+      const auto model_get_usec = g_get_monotonic_time() - begin;
+      EXPECT_EQ(size_t(n_lookups), found);
+
+      std::printf("%6d transfers: add: map %.1f ns, model %.1f ns; get: map %.1f ns, model %.1f ns\n",
+                  n,
+                  map_add_usec * 1000.0 / n,
+                  model_add_usec * 1000.0 / n,
+                  map_get_usec * 1000.0 / n_lookups,
+                  model_get_usec * 1000.0 / n_lookups);
+    }
+}
+
+TEST(Model, DISABLED_ColumnsBenchmark)
+{
+  for (const int n : {10000, 100000})
+    {
+      constexpr int n_scans {200};
+      auto transfers = create_transfers(n);
+      MutableModel model;
+      for (int i=0; i<n; ++i)
+        {
+          transfers[i]->state = Transfer::State(i % (Transfer::ERROR+1));
+          transfers[i]->speed_Bps = i;
+          model.add(transfers[i]);
+        }
+      const auto mask = Model::state_bit(Transfer::RUNNING);
+
+      // baseline: walking the transfers themselves
+      int walk_running = 0;
+      uint64_t walk_speed = 0;
+      auto begin = g_get_monotonic_time();
+      for (int i=0; i<n_scans; ++i)
+        model.for_each([&](const Transfer& t){
+          walk_running += t.state == Transfer::RUNNING;
+          walk_speed += t.speed_Bps;
+        });
+      const auto walk_usec = g_get_monotonic_time() - begin;
+
+      int column_running = 0;
+      uint64_t column_speed = 0;
+      begin = g_get_monotonic_time();
+      for (int i=0; i<n_scans; ++i)
+        {
+          column_running += model.count_in_states(mask);
+          column_speed += model.sum_speed();
+        }
+      const auto column_usec = g_get_monotonic_time() - begin;
+
+      EXPECT_EQ(walk_running, column_running);
+      EXPECT_EQ(walk_speed, column_speed);
+      std::printf("%6d transfers: count running + sum speed: walk %.2f ns, columns %.2f ns per transfer\n",
+                  n,
+                  walk_usec * 1000.0 / (double(n) * n_scans),
+                  column_usec * 1000.0 / (double(n) * n_scans));
+    }
+}
+
+namespace
+{
+  // the number of bytes currently allocated on the heap
+  size_t get_heap_bytes()
+  {
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#else
+    return size_t(mallinfo().uordblks);
+#endif
+  }
+}
+
+TEST(Model, DISABLED_MemoryReport)
+{
+  constexpr int n {10000};
+  const auto before = get_heap_bytes();
+
+  // a mix that looks like a day's worth of downloads:
+  // mostly finished, some running, a few errors
+  {
+    MutableModel model;
+    for (int i=0; i<n; ++i)
+      {
+        auto transfer = std::make_shared<Transfer>();
+        transfer->id = Transfer::Id(std::to_string(1000+i));
+        transfer->title = "Download " + std::to_string(i) + ".zip";
+        transfer->app_icon = "/usr/share/icons/hicolor/scalable/apps/some-app.svg";
+        transfer->total_size = 1000000;
+        if (i % 10 == 0)
+          {
+            transfer->state = Transfer::ERROR;
+            transfer->set_error_string("The connection was reset");
+          }
+        else if (i % 3 == 0)
+          {
+            transfer->state = Transfer::RUNNING;
+            transfer->progress = 0.5;
+          }
+        else
+          {
+            transfer->state = Transfer::FINISHED;
+            transfer->progress = 1.0;
+            transfer->set_local_path("/home/phablet/Downloads/" + transfer->title);
+          }
+        model.add(transfer);
+      }
+
+    const auto after = get_heap_bytes();
+    std::printf("%d transfers: sizeof(Transfer) %zu, %.1f heap bytes per transfer\n",
+                n,
+                sizeof(Transfer),
+                double(after - before) / n);
+    EXPECT_LT(sizeof(Transfer) * n, after - before);
+  }
+}
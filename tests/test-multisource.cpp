@@ -45,7 +45,9 @@ protected:
     // test get_all()
     std::vector<std::shared_ptr<Transfer>> transfers(list);
     std::sort(transfers.begin(), transfers.end());
-    g_return_val_if_fail(transfers == model->get_all(), false);
+    auto all = model->get_all();
+    std::sort(all.begin(), all.end());
+    g_return_val_if_fail(transfers == all, false);
 
     // test get()
     for(auto& transfer : transfers)
@@ -124,6 +126,30 @@ TEST_F(MultiSourceFixture,MultiplexesModels)
   EXPECT_TRUE(model_consists_of(multimodel, {}));
 }
 
+TEST_F(MultiSourceFixture,ImportsExistingTransfers)
+{
+  // a source that already has a transfer when it's added...
+  auto a = std::make_shared<MockSource>();
+  const Transfer::Id aid {"aid"};
+  auto at = std::make_shared<Transfer>();
+  at->id = aid;
+  a->m_model->add(at);
+
+  MultiSource multisource;
+  auto multimodel = multisource.get_model();
+  int n_batches = 0;
+  multimodel->batch().connect([&n_batches](const Model::Changes&){++n_batches;});
+  multisource.add_source(a);
+
+  // ...has it imported in one batch, and is delegated to for it
+  EXPECT_EQ(1, n_batches);
+  EXPECT_TRUE(model_consists_of(multimodel, {at}));
+  EXPECT_CALL(*a, pause(aid)); multisource.pause(aid);
+
+  a->m_model->remove(aid);
+  EXPECT_TRUE(model_consists_of(multimodel, {}));
+}
+
 TEST(Multisource,MethodDelegation)
 {
   // set up the tributary sources, 'a' and 'b'
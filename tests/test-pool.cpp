@@ -0,0 +1,140 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pool.h"
+#include <transfer/transfer.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+
+using namespace unity::indicator::transfer;
+
+TEST(Pool, ReusesFreedBlocks)
+{
+  Pool pool;
+
+  auto a = pool.allocate(40);
+  auto b = pool.allocate(40);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(a) % Pool::BLOCK_ALIGN);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(b) % Pool::BLOCK_ALIGN);
+
+  // a freed block goes back to its size class's free list...
+  pool.deallocate(a, 40);
+  EXPECT_EQ(a, pool.allocate(40));
+
+  // ...so a different size class doesn't get it
+  pool.deallocate(b, 40);
+  auto c = pool.allocate(400);
+  EXPECT_NE(b, c);
+
+  auto stats = pool.get_stats();
+  EXPECT_EQ(4u, stats.n_allocs);
+  EXPECT_EQ(2u, stats.n_frees);
+  EXPECT_EQ(1u, stats.n_reused);
+  EXPECT_EQ(0u, stats.n_large_allocs);
+  EXPECT_EQ(2u, stats.n_live);
+  EXPECT_EQ(440u, stats.bytes_live);
+  EXPECT_EQ(440u, stats.peak_bytes_live);
+  EXPECT_EQ(1u, stats.n_chunks);
+  EXPECT_EQ(Pool::DEFAULT_CHUNK_SIZE, stats.bytes_reserved);
+
+  pool.deallocate(a, 40);
+  pool.deallocate(c, 400);
+  stats = pool.get_stats();
+  EXPECT_EQ(0u, stats.n_live);
+  EXPECT_EQ(0u, stats.bytes_live);
+}
+
+TEST(Pool, LargeAllocations)
+{
+  Pool pool;
+
+  const size_t n_bytes = Pool::MAX_BLOCK_SIZE + 1;
+  auto p = pool.allocate(n_bytes);
+  ASSERT_NE(nullptr, p);
+  auto stats = pool.get_stats();
+  EXPECT_EQ(1u, stats.n_large_allocs);
+  EXPECT_EQ(n_bytes, stats.bytes_live);
+  EXPECT_EQ(0u, stats.n_chunks);
+
+  pool.deallocate(p, n_bytes);
+  stats = pool.get_stats();
+  EXPECT_EQ(0u, stats.n_live);
+  EXPECT_EQ(0u, stats.n_reused);
+}
+
+TEST(Pool, GrowsByChunks)
+{
+  Pool pool(Pool::MAX_BLOCK_SIZE);
+
+  std::vector<void*> blocks;
+  for (int i=0; i<10; ++i)
+    blocks.push_back(pool.allocate(Pool::MAX_BLOCK_SIZE));
+  EXPECT_EQ(10u, pool.get_stats().n_chunks);
+
+  for (auto& block : blocks)
+    pool.deallocate(block, Pool::MAX_BLOCK_SIZE);
+  for (int i=0; i<10; ++i)
+    blocks[i] = pool.allocate(Pool::MAX_BLOCK_SIZE);
+  EXPECT_EQ(10u, pool.get_stats().n_chunks);
+  EXPECT_EQ(10u, pool.get_stats().n_reused);
+
+  for (auto& block : blocks)
+    pool.deallocate(block, Pool::MAX_BLOCK_SIZE);
+}
+
+TEST(Pool, Allocator)
+{
+  auto pool = std::make_shared<Pool>();
+
+  // the transfer's allocator keeps the pool alive...
+  std::weak_ptr<Pool> weak_pool = pool;
+  auto transfer = std::allocate_shared<Transfer>(PoolAllocator<Transfer>(pool));
+  pool.reset();
+  ASSERT_FALSE(weak_pool.expired());
+  EXPECT_EQ(1u, weak_pool.lock()->get_stats().n_live);
+
+  // ...until the transfer's gone
+  transfer.reset();
+  EXPECT_TRUE(weak_pool.expired());
+}
+
+TEST(Pool, Map)
+{
+  typedef std::pair<const Transfer::Id,int> value_type;
+  typedef std::map<Transfer::Id,int,std::less<Transfer::Id>,PoolAllocator<value_type>> Map;
+
+  auto pool = std::make_shared<Pool>();
+  Map map {PoolAllocator<value_type>(pool)};
+
+  for (int i=1; i<=100; ++i)
+    map.emplace(std::to_string(i), i);
+  EXPECT_EQ(100u, pool->get_stats().n_live);
+
+  map.clear();
+  EXPECT_EQ(0u, pool->get_stats().n_live);
+
+  // churn reuses the same nodes
+  for (int i=1; i<=100; ++i)
+    map.emplace(std::to_string(i), i);
+  const auto stats = pool->get_stats();
+  EXPECT_EQ(100u, stats.n_reused);
+  EXPECT_EQ(1u, stats.n_chunks);
+}
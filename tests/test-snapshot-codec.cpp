@@ -0,0 +1,348 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "snapshot-codec.h"
+
+#include <gtest/gtest.h>
+
+#include <glib.h>
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace unity::indicator::transfer;
+
+namespace
+{
+  std::shared_ptr<Transfer> create_transfer(int i)
+  {
+    auto transfer = std::make_shared<Transfer>();
+    transfer->id = Transfer::Id("/com/canonical/applications/download/" + std::to_string(i));
+    transfer->state = Transfer::State(i % (Transfer::ERROR+1));
+    transfer->seconds_left = i % 7 ? 60+i : -1;
+    transfer->time_started = 1450000000 + i;
+    transfer->progress = (i % 100) / 100.0f;
+    transfer->speed_Bps = 1000 * i;
+    transfer->total_size = 1000000 + i;
+    transfer->title = "File " + std::to_string(i) + ".zip";
+    transfer->app_icon = "/usr/share/icons/app" + std::to_string(i % 5) + ".png";
+    if (transfer->state == Transfer::ERROR)
+      transfer->set_error_string("Disk full");
+    if (transfer->state == Transfer::FINISHED)
+      transfer->set_local_path("/home/user/Downloads/" + transfer->title);
+    if (transfer->state == Transfer::HASHING)
+      transfer->set_custom_state("Verifying");
+    return transfer;
+  }
+
+  void fill(MutableModel& model, int n)
+  {
+    model.begin_batch();
+    for (int i=0; i<n; ++i)
+      model.add(create_transfer(i));
+    model.end_batch();
+  }
+
+  void expect_same(const Transfer& a, const Transfer& b)
+  {
+    EXPECT_EQ(a.id, b.id);
+    EXPECT_EQ(a.state, b.state);
+    EXPECT_EQ(a.seconds_left, b.seconds_left);
+    EXPECT_EQ(a.time_started, b.time_started);
+    EXPECT_EQ(a.progress, b.progress);
+    EXPECT_EQ(a.speed_Bps, b.speed_Bps);
+    EXPECT_EQ(a.total_size, b.total_size);
+    EXPECT_EQ(a.title, b.title);
+    EXPECT_EQ(a.app_icon, b.app_icon);
+    EXPECT_EQ(a.custom_state(), b.custom_state());
+    EXPECT_EQ(a.error_string(), b.error_string());
+    EXPECT_EQ(a.local_path(), b.local_path());
+  }
+
+  void expect_same(const Model& a, const Model& b)
+  {
+    ASSERT_EQ(a.get_ids(), b.get_ids());
+    for (const auto& transfer : a.get_all())
+      expect_same(*transfer, *b.get(transfer->id));
+  }
+
+  // the GVariant we'd send if we used the a{sv} encoding of GActions' transfer states
+  GVariant* create_variant(const Model::Snapshot& snapshot)
+  {
+    GVariantBuilder b;
+    g_variant_builder_init(&b, G_VARIANT_TYPE("a{sa{sv}}"));
+    snapshot.for_each([&b](const Transfer& t){
+      g_variant_builder_open(&b, G_VARIANT_TYPE("{sa{sv}}"));
+      g_variant_builder_add(&b, "s", t.id.str().c_str());
+      g_variant_builder_open(&b, G_VARIANT_TYPE_VARDICT);
+      g_variant_builder_add(&b, "{sv}", "state", g_variant_new_int32(t.state));
+      g_variant_builder_add(&b, "{sv}", "percent", g_variant_new_double(t.progress));
+      g_variant_builder_add(&b, "{sv}", "seconds-left", g_variant_new_int32(t.seconds_left));
+      g_variant_builder_add(&b, "{sv}", "time-started", g_variant_new_int64(t.time_started));
+      g_variant_builder_add(&b, "{sv}", "speed", g_variant_new_uint64(t.speed_Bps));
+      g_variant_builder_add(&b, "{sv}", "total-size", g_variant_new_uint64(t.total_size));
+      g_variant_builder_add(&b, "{sv}", "title", g_variant_new_string(t.title.c_str()));
+      g_variant_builder_add(&b, "{sv}", "app-icon", g_variant_new_string(t.app_icon.c_str()));
+      g_variant_builder_add(&b, "{sv}", "state-label", g_variant_new_string(t.custom_state().c_str()));
+      g_variant_builder_add(&b, "{sv}", "error-string", g_variant_new_string(t.error_string().c_str()));
+      g_variant_builder_add(&b, "{sv}", "local-path", g_variant_new_string(t.local_path().c_str()));
+      g_variant_builder_close(&b);
+      g_variant_builder_close(&b);
+    });
+    return g_variant_ref_sink(g_variant_builder_end(&b));
+  }
+
+  std::vector<std::shared_ptr<Transfer>> parse_variant(GVariant* v)
+  {
+    std::vector<std::shared_ptr<Transfer>> transfers;
+    GVariantIter iter;
+    const gchar* id;
+    GVariant* dict;
+    g_variant_iter_init(&iter, v);
+    while (g_variant_iter_loop(&iter, "{&s@a{sv}}", &id, &dict))
+      {
+        auto t = std::make_shared<Transfer>();
+        t->id = Transfer::Id(id);
+        gint32 i32;
+        gint64 i64;
+        guint64 u64;
+        gdouble d;
+        const gchar* s;
+        if (g_variant_lookup(dict, "state", "i", &i32))
+          t->state = Transfer::State(i32);
+        if (g_variant_lookup(dict, "percent", "d", &d))
+          t->progress = d;
+        if (g_variant_lookup(dict, "seconds-left", "i", &i32))
+          t->seconds_left = i32;
+        if (g_variant_lookup(dict, "time-started", "x", &i64))
+          t->time_started = i64;
+        if (g_variant_lookup(dict, "speed", "t", &u64))
+          t->speed_Bps = u64;
+        if (g_variant_lookup(dict, "total-size", "t", &u64))
+          t->total_size = u64;
+        if (g_variant_lookup(dict, "title", "&s", &s))
+          t->title = s;
+        if (g_variant_lookup(dict, "app-icon", "&s", &s))
+          t->app_icon = s;
+        if (g_variant_lookup(dict, "state-label", "&s", &s))
+          t->set_custom_state(s);
+        if (g_variant_lookup(dict, "error-string", "&s", &s))
+          t->set_error_string(s);
+        if (g_variant_lookup(dict, "local-path", "&s", &s))
+          t->set_local_path(s);
+        transfers.push_back(t);
+      }
+    return transfers;
+  }
+}
+
+TEST(SnapshotCodec, RoundTrip)
+{
+  MutableModel model;
+  fill(model, 100);
+  const auto snapshot = model.snapshot();
+
+  const auto encoded = SnapshotCodec::encode(*snapshot);
+  SnapshotCodec::Decoded decoded;
+  ASSERT_TRUE(SnapshotCodec::decode(encoded, decoded));
+  EXPECT_FALSE(decoded.is_delta);
+  EXPECT_EQ(snapshot->generation(), decoded.generation);
+  ASSERT_EQ(100u, decoded.records.size());
+  EXPECT_TRUE(decoded.removed.empty());
+
+  MutableModel replica;
+  EXPECT_TRUE(SnapshotCodec::apply(decoded, replica));
+  expect_same(model, replica);
+
+  // a full snapshot also removes what the replica has that the snapshot doesn't
+  auto extra = create_transfer(1000);
+  replica.add(extra);
+  model.remove(model.get_all().front()->id);
+  ASSERT_TRUE(SnapshotCodec::decode(SnapshotCodec::encode(*model.snapshot()), decoded));
+  EXPECT_TRUE(SnapshotCodec::apply(decoded, replica));
+  expect_same(model, replica);
+
+  // an empty model
+  MutableModel empty;
+  ASSERT_TRUE(SnapshotCodec::decode(SnapshotCodec::encode(*empty.snapshot()), decoded));
+  EXPECT_TRUE(decoded.records.empty());
+  EXPECT_TRUE(SnapshotCodec::apply(decoded, replica));
+  EXPECT_EQ(0, replica.size());
+}
+
+TEST(SnapshotCodec, Deltas)
+{
+  MutableModel model;
+  fill(model, 100);
+  const auto before = model.snapshot();
+  MutableModel replica;
+  SnapshotCodec::Decoded decoded;
+  ASSERT_TRUE(SnapshotCodec::decode(SnapshotCodec::encode(*before), decoded));
+  ASSERT_TRUE(SnapshotCodec::apply(decoded, replica));
+
+  // change a field, change some strings, remove one, and reuse its handle
+  const auto all = model.get_all();
+  model.begin_batch();
+  all[1]->progress = 0.99f;
+  model.emit_changed(all[1]->id, Transfer::FIELD_PROGRESS);
+  all[2]->state = Transfer::FINISHED;
+  all[2]->set_local_path("/tmp/done");
+  model.emit_changed(all[2]->id);
+  model.remove(all[3]->id);
+  model.add(create_transfer(1000));
+  model.end_batch();
+  const auto after = model.snapshot();
+
+  const auto delta = SnapshotCodec::encode_delta(*before, *after);
+  EXPECT_LT(delta.size(), SnapshotCodec::encode(*after).size() / 10);
+
+  ASSERT_TRUE(SnapshotCodec::decode(delta, decoded));
+  EXPECT_TRUE(decoded.is_delta);
+  EXPECT_EQ(before->generation(), decoded.base_generation);
+  EXPECT_EQ(after->generation(), decoded.generation);
+  ASSERT_EQ(1u, decoded.removed.size());
+  EXPECT_EQ(all[3]->id, decoded.removed.front());
+  std::map<Transfer::Id,Transfer::Fields> fields;
+  for (const auto& record : decoded.records)
+    fields[record.transfer->id] = record.fields;
+  EXPECT_EQ(3u, fields.size());
+  EXPECT_EQ(Transfer::FIELD_PROGRESS, fields[all[1]->id]);
+  EXPECT_EQ(Transfer::FIELD_STATE|Transfer::FIELD_LOCAL_PATH, fields[all[2]->id]);
+  EXPECT_EQ(SnapshotCodec::ALL_COLUMNS, fields[create_transfer(1000)->id]);
+
+  EXPECT_TRUE(SnapshotCodec::apply(decoded, replica));
+  expect_same(model, replica);
+
+  // a snapshot's delta against itself is empty
+  ASSERT_TRUE(SnapshotCodec::decode(SnapshotCodec::encode_delta(*after, *after), decoded));
+  EXPECT_TRUE(decoded.records.empty());
+  EXPECT_TRUE(decoded.removed.empty());
+
+  // a delta that changes a transfer the replica doesn't have is reported
+  MutableModel stale;
+  ASSERT_TRUE(SnapshotCodec::decode(delta, decoded));
+  EXPECT_FALSE(SnapshotCodec::apply(decoded, stale));
+}
+
+TEST(SnapshotCodec, RejectsBadInput)
+{
+  MutableModel model;
+  fill(model, 10);
+  const auto encoded = SnapshotCodec::encode(*model.snapshot());
+
+  SnapshotCodec::Decoded decoded;
+  for (size_t n=0; n<encoded.size(); ++n)
+    EXPECT_FALSE(SnapshotCodec::decode(encoded.substr(0, n), decoded)) << n;
+  EXPECT_FALSE(SnapshotCodec::decode(encoded + '\0', decoded));
+
+  // a newer version
+  auto newer = encoded;
+  newer[4] = char(SnapshotCodec::VERSION + 1);
+  EXPECT_FALSE(SnapshotCodec::decode(newer, decoded));
+
+  // not a snapshot
+  auto garbage = encoded;
+  garbage[0] = 'X';
+  EXPECT_FALSE(SnapshotCodec::decode(garbage, decoded));
+
+  // counts that claim more than the buffer holds
+  auto huge = encoded;
+  for (size_t i=28; i<32; ++i)
+    huge[i] = char(0xFF);
+  EXPECT_FALSE(SnapshotCodec::decode(huge, decoded));
+
+  EXPECT_TRUE(SnapshotCodec::decode(encoded, decoded));
+}
+
+TEST(SnapshotCodec, DISABLED_Benchmark)
+{
+  for (const int n : {100, 10000})
+    {
+      constexpr int n_reps {5};
+      MutableModel model;
+      fill(model, n);
+      const auto snapshot = model.snapshot();
+
+      // baseline: an a{sa{sv}} GVariant
+      GVariant* v = nullptr;
+      std::string variant_bytes;
+      auto begin = g_get_monotonic_time();
+      for (int i=0; i<n_reps; ++i)
+        {
+          if (v != nullptr)
+            g_variant_unref(v);
+          v = create_variant(*snapshot);
+          variant_bytes.assign(static_cast<const char*>(g_variant_get_data(v)), g_variant_get_size(v));
+        }
+      const auto variant_encode_usec = g_get_monotonic_time() - begin;
+
+      size_t n_parsed = 0;
+      begin = g_get_monotonic_time();
+      for (int i=0; i<n_reps; ++i)
+        {
+          auto parsed = g_variant_new_from_data(G_VARIANT_TYPE("a{sa{sv}}"),
+                                                variant_bytes.data(), variant_bytes.size(),
+                                                FALSE, nullptr, nullptr);
+          n_parsed += parse_variant(parsed).size();
+          g_variant_unref(g_variant_ref_sink(parsed));
+        }
+      const auto variant_decode_usec = g_get_monotonic_time() - begin;
+      g_variant_unref(v);
+
+      std::string encoded;
+      begin = g_get_monotonic_time();
+      for (int i=0; i<n_reps; ++i)
+        encoded = SnapshotCodec::encode(*snapshot);
+      const auto codec_encode_usec = g_get_monotonic_time() - begin;
+
+      size_t n_decoded = 0;
+      begin = g_get_monotonic_time();
+      for (int i=0; i<n_reps; ++i)
+        {
+          SnapshotCodec::Decoded decoded;
+          EXPECT_TRUE(SnapshotCodec::decode(encoded, decoded));
+          n_decoded += decoded.records.size();
+        }
+      const auto codec_decode_usec = g_get_monotonic_time() - begin;
+      EXPECT_EQ(size_t(n * n_reps), n_decoded);
+
+      // a progress tick on 1% of the transfers
+      const auto all = model.get_all();
+      model.begin_batch();
+      for (int i=0; i<n; i+=100)
+        {
+          all[i]->progress += 0.001f;
+          model.emit_changed(all[i]->id, Transfer::FIELD_PROGRESS);
+        }
+      model.end_batch();
+      const auto delta = SnapshotCodec::encode_delta(*snapshot, *model.snapshot());
+
+      std::printf("%6d transfers: size: gvariant %zu B, codec %zu B, 1%% delta %zu B; "
+                  "encode: gvariant %.2f us, codec %.2f us; decode: gvariant %.2f us, codec %.2f us (per transfer)\n",
+                  n,
+                  variant_bytes.size(),
+                  encoded.size(),
+                  delta.size(),
+                  double(variant_encode_usec) / (n * n_reps),
+                  double(codec_encode_usec) / (n * n_reps),
+                  double(variant_decode_usec) / (n * n_reps),
+                  double(codec_decode_usec) / (n * n_reps));
+      EXPECT_EQ(size_t(n * n_reps), n_parsed);
+    }
+}
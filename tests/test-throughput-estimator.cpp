@@ -0,0 +1,210 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "throughput-estimator.h"
+
+#include <gtest/gtest.h>
+
+#include <glib.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+using namespace unity::indicator::transfer;
+
+namespace
+{
+  constexpr int64_t USEC_PER_SEC {1000000};
+
+  /**
+   * The vector-based averaging that DMTransfer used before
+   * ThroughputEstimator, kept here as a benchmark baseline.
+   */
+  class LegacyEstimator
+  {
+  public:
+    uint64_t add_sample(int64_t time_usec, uint64_t bytes)
+    {
+      m_history.push_back(DownloadProgress{time_usec, bytes});
+
+      static constexpr int max_slots = 50;
+      if (m_history.size() > max_slots)
+        m_history.erase(m_history.begin(), m_history.end()-max_slots);
+
+      static constexpr int64_t max_age_usec = 30 * USEC_PER_SEC;
+      const auto oldest_allowed_usec = time_usec - max_age_usec;
+      const auto is_young = [oldest_allowed_usec](const DownloadProgress& p){return p.time_usec >= oldest_allowed_usec;};
+      m_history.erase(std::begin(m_history), std::find_if(std::begin(m_history), std::end(m_history), is_young));
+
+      if (m_history.size() < 2)
+        return 0;
+
+      const auto& a = m_history.front();
+      const auto& b = m_history.back();
+      return ((b.bytes - a.bytes) * USEC_PER_SEC) / (b.time_usec - a.time_usec);
+    }
+
+  private:
+    struct DownloadProgress {
+      int64_t time_usec;
+      uint64_t bytes;
+    };
+    std::vector<DownloadProgress> m_history;
+  };
+}
+
+TEST(ThroughputEstimator, NeedsTwoSamples)
+{
+  ThroughputEstimator estimator;
+  EXPECT_EQ(0, estimator.get_Bps());
+
+  estimator.add_sample(0, 0);
+  EXPECT_EQ(0, estimator.get_Bps());
+
+  estimator.add_sample(USEC_PER_SEC, 1000);
+  EXPECT_EQ(1000, estimator.get_Bps());
+}
+
+TEST(ThroughputEstimator, WindowedConstantRate)
+{
+  ThroughputEstimator estimator(ThroughputEstimator::WINDOWED, 10);
+  EXPECT_EQ(10, estimator.capacity());
+
+  for (int i=0; i<100; ++i)
+    estimator.add_sample(i*USEC_PER_SEC, i*4096);
+
+  EXPECT_EQ(10, estimator.size());
+  EXPECT_EQ(4096, estimator.get_Bps());
+}
+
+TEST(ThroughputEstimator, WindowedCapacityLimit)
+{
+  ThroughputEstimator estimator(ThroughputEstimator::WINDOWED, 3);
+
+  // a fast start...
+  estimator.add_sample(0*USEC_PER_SEC, 0);
+  estimator.add_sample(1*USEC_PER_SEC, 10000);
+
+  // ...followed by a slow stretch that pushes it out of the window
+  estimator.add_sample(2*USEC_PER_SEC, 10100);
+  estimator.add_sample(3*USEC_PER_SEC, 10200);
+  estimator.add_sample(4*USEC_PER_SEC, 10300);
+  EXPECT_EQ(100, estimator.get_Bps());
+}
+
+TEST(ThroughputEstimator, WindowedAgeLimit)
+{
+  ThroughputEstimator estimator(ThroughputEstimator::WINDOWED, 50, 10*USEC_PER_SEC);
+
+  estimator.add_sample(0, 0);
+  estimator.add_sample(1*USEC_PER_SEC, 1000000);
+
+  // after a long stall, the old samples shouldn't count anymore
+  estimator.add_sample(60*USEC_PER_SEC, 1000100);
+  EXPECT_EQ(1, estimator.size());
+  EXPECT_EQ(0, estimator.get_Bps());
+
+  estimator.add_sample(61*USEC_PER_SEC, 1000200);
+  EXPECT_EQ(100, estimator.get_Bps());
+}
+
+TEST(ThroughputEstimator, Ewma)
+{
+  ThroughputEstimator estimator(ThroughputEstimator::EWMA, 2, 30*USEC_PER_SEC, 0.5);
+  EXPECT_EQ(ThroughputEstimator::EWMA, estimator.mode());
+
+  estimator.add_sample(0, 0);
+  estimator.add_sample(1*USEC_PER_SEC, 1000);
+  EXPECT_EQ(1000, estimator.get_Bps());
+
+  estimator.add_sample(2*USEC_PER_SEC, 4000);
+  EXPECT_EQ(2000, estimator.get_Bps());
+
+  // converges on a steady rate
+  uint64_t bytes = 4000;
+  for (int i=3; i<50; ++i)
+    estimator.add_sample(i*USEC_PER_SEC, bytes+=500);
+  EXPECT_EQ(500, estimator.get_Bps());
+}
+
+TEST(ThroughputEstimator, Reset)
+{
+  ThroughputEstimator estimator;
+  estimator.add_sample(0, 0);
+  estimator.add_sample(USEC_PER_SEC, 1000);
+  EXPECT_EQ(1000, estimator.get_Bps());
+
+  estimator.reset();
+  EXPECT_EQ(0, estimator.size());
+  EXPECT_EQ(0, estimator.get_Bps());
+
+  // going backwards is treated as a restart
+  estimator.add_sample(2*USEC_PER_SEC, 5000);
+  estimator.add_sample(3*USEC_PER_SEC, 100);
+  EXPECT_EQ(1, estimator.size());
+}
+
+TEST(ThroughputEstimator, SameTimestamp)
+{
+  ThroughputEstimator estimator;
+  estimator.add_sample(USEC_PER_SEC, 0);
+  estimator.add_sample(USEC_PER_SEC, 1000);
+  EXPECT_EQ(0, estimator.get_Bps());
+}
+
+TEST(ThroughputEstimator, MatchesLegacy)
+{
+  ThroughputEstimator estimator;
+  LegacyEstimator legacy;
+
+  // irregular sample spacing and rates
+  int64_t t = 0;
+  uint64_t bytes = 0;
+  for (int i=0; i<500; ++i)
+    {
+      t += (i%7 + 1) * 100000;
+      bytes += (i%13) * 1024;
+      EXPECT_EQ(legacy.add_sample(t, bytes), (estimator.add_sample(t, bytes), estimator.get_Bps()));
+    }
+}
+
+TEST(ThroughputEstimator, DISABLED_Benchmark)
+{
+  constexpr int n_samples {1000000};
+
+  auto run = [](std::function<uint64_t(int64_t,uint64_t)> add){
+    uint64_t sum = 0;
+    const auto begin = g_get_monotonic_time();
+    for (int i=1; i<=n_samples; ++i)
+      sum += add(int64_t(i)*250000, uint64_t(i)*8192);
+    const auto elapsed = g_get_monotonic_time() - begin;
+    EXPECT_EQ(uint64_t(n_samples-1)*32768, sum);
+    return elapsed;
+  };
+
+  LegacyEstimator legacy;
+  const auto legacy_usec = run([&legacy](int64_t t, uint64_t b){return legacy.add_sample(t,b);});
+
+  ThroughputEstimator estimator;
+  const auto ring_usec = run([&estimator](int64_t t, uint64_t b){estimator.add_sample(t,b); return estimator.get_Bps();});
+
+  std::printf("%d samples: legacy %.1f ns/sample, ring buffer %.1f ns/sample\n",
+              n_samples,
+              legacy_usec * 1000.0 / n_samples,
+              ring_usec * 1000.0 / n_samples);
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tombstone-set.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using namespace unity::indicator::transfer;
+
+TEST(TombstoneSet, InsertAndContains)
+{
+  TombstoneSet tombstones(10);
+  EXPECT_FALSE(tombstones.contains("/a"));
+
+  tombstones.insert("/a");
+  tombstones.insert("/a");
+  EXPECT_TRUE(tombstones.contains("/a"));
+  EXPECT_FALSE(tombstones.contains("/b"));
+
+  const auto stats = tombstones.stats();
+  EXPECT_EQ(1u, stats.n_entries);
+  EXPECT_LT(0u, stats.n_bytes);
+  EXPECT_EQ(0u, stats.n_evictions);
+}
+
+TEST(TombstoneSet, EvictsLeastRecentlyUsed)
+{
+  TombstoneSet tombstones(3);
+  tombstones.insert("/a");
+  tombstones.insert("/b");
+  tombstones.insert("/c");
+
+  // a lookup or a repeated insert counts as a use
+  EXPECT_TRUE(tombstones.contains("/a"));
+  tombstones.insert("/b");
+
+  // so "/c" is the oldest now
+  tombstones.insert("/d");
+  EXPECT_FALSE(tombstones.contains("/c"));
+  EXPECT_TRUE(tombstones.contains("/a"));
+  EXPECT_TRUE(tombstones.contains("/b"));
+  EXPECT_TRUE(tombstones.contains("/d"));
+
+  // and then "/a", which was used least recently by the checks above
+  tombstones.insert("/e");
+  EXPECT_FALSE(tombstones.contains("/a"));
+
+  const auto stats = tombstones.stats();
+  EXPECT_EQ(3u, stats.n_entries);
+  EXPECT_EQ(2u, stats.n_evictions);
+}
+
+TEST(TombstoneSet, Clear)
+{
+  TombstoneSet tombstones(3);
+  tombstones.clear();
+  EXPECT_EQ(0u, tombstones.stats().n_clears);
+
+  tombstones.insert("/a");
+  tombstones.insert("/b");
+  tombstones.clear();
+  EXPECT_FALSE(tombstones.contains("/a"));
+  EXPECT_FALSE(tombstones.contains("/b"));
+
+  const auto stats = tombstones.stats();
+  EXPECT_EQ(0u, stats.n_entries);
+  EXPECT_EQ(0u, stats.n_bytes);
+  EXPECT_EQ(1u, stats.n_clears);
+}
+
+TEST(TombstoneSet, ZeroCapacityHoldsOne)
+{
+  TombstoneSet tombstones(0);
+  tombstones.insert("/a");
+  EXPECT_TRUE(tombstones.contains("/a"));
+  tombstones.insert("/b");
+  EXPECT_FALSE(tombstones.contains("/a"));
+  EXPECT_TRUE(tombstones.contains("/b"));
+}
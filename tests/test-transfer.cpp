@@ -0,0 +1,96 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <transfer/transfer.h>
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using namespace unity::indicator::transfer;
+
+namespace
+{
+  struct UniqueTransfer: public Transfer
+  {
+    UniqueTransfer() { id = next_unique_id(); }
+  };
+}
+
+TEST(TransferId, Empty)
+{
+  const Transfer::Id id;
+  EXPECT_TRUE(id.empty());
+  EXPECT_EQ(std::string(), id.str());
+  EXPECT_EQ(id, Transfer::Id(""));
+  EXPECT_EQ(id, Transfer::Id(static_cast<const char*>(nullptr)));
+  EXPECT_FALSE(Transfer::Id("a").empty());
+}
+
+TEST(TransferId, Interned)
+{
+  const std::string path {"/com/canonical/applications/download/1"};
+  const Transfer::Id a {path};
+  const Transfer::Id b {path.c_str()};
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(a.value(), b.value());
+  EXPECT_EQ(path, a.str());
+  EXPECT_EQ(path, b.str());
+  EXPECT_NE(a, Transfer::Id("/com/canonical/applications/download/2"));
+}
+
+TEST(TransferId, Decimal)
+{
+  // decimal strings map straight to their value
+  EXPECT_EQ(1234u, Transfer::Id("1234").value());
+  EXPECT_EQ("1234", Transfer::Id("1234").str());
+
+  // other strings that look numeric are interned, so they keep their form
+  for (const auto& str : {"0", "01234", "1234x", "-1", "99999999999"})
+    {
+      const Transfer::Id id {str};
+      EXPECT_EQ(str, id.str());
+      EXPECT_NE(Transfer::Id("1234"), id);
+    }
+}
+
+TEST(TransferId, UniqueIdsRoundTrip)
+{
+  const UniqueTransfer a;
+  const UniqueTransfer b;
+  EXPECT_NE(a.id, b.id);
+
+  // an id that went out over D-Bus and came back as a string is the same id
+  EXPECT_EQ(a.id, Transfer::Id(a.id.str()));
+  EXPECT_EQ(b.id, Transfer::Id(b.id.str().c_str()));
+}
+
+TEST(TransferId, Find)
+{
+  // decimal strings don't need interning, so they're always found
+  EXPECT_EQ(Transfer::Id("1234"), Transfer::Id::find("1234"));
+
+  const Transfer::Id known {"/find/known"};
+  EXPECT_EQ(known, Transfer::Id::find("/find/known"));
+  EXPECT_EQ(known, Transfer::Id::find(std::string("/find/known")));
+
+  // other strings aren't interned by looking for them
+  EXPECT_TRUE(Transfer::Id::find("/find/unknown").empty());
+  EXPECT_TRUE(Transfer::Id::find("").empty());
+  EXPECT_TRUE(Transfer::Id::find(static_cast<const char*>(nullptr)).empty());
+  const Transfer::Id unknown {"/find/unknown"};
+  EXPECT_EQ(unknown, Transfer::Id::find("/find/unknown"));
+}
@@ -55,15 +55,15 @@ protected:
     m_source.reset(new MockSource);
     std::shared_ptr<Transfer> t;
     t.reset(new Transfer);
-    t->id = "a";
+    t->id = Transfer::Id("a");
     t->state = Transfer::RUNNING;
     m_source->m_model->add(t);
     t.reset(new Transfer);
-    t->id = "b";
+    t->id = Transfer::Id("b");
     t->state = Transfer::PAUSED;
     m_source->m_model->add(t);
     t.reset(new Transfer);
-    t->id = "c";
+    t->id = Transfer::Id("c");
     t->state = Transfer::FINISHED;
     m_source->m_model->add(t);
     m_controller.reset(new MockController(m_source));
@@ -145,7 +145,7 @@ TEST_F(GMenuViewFixture, ExportedActions)
     "resume-transfer"
   };
   for (const auto& id : m_source->get_model()->get_ids())
-    expected_actions.insert("transfer-state." + id);
+    expected_actions.insert("transfer-state." + id.str());
 
   auto connection = g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, nullptr);
   auto exported = g_dbus_action_group_get(connection, BUS_NAME, BUS_PATH);
@@ -201,35 +201,35 @@ TEST_F(GMenuViewFixture, InvokedGActionsCallTheController)
   g_strfreev(names_strv);
 
   // try tapping a transfer that can be resumed
-  const char* id = "b";
+  Transfer::Id id("b");
   EXPECT_TRUE(m_source->get_model()->get(id)->can_resume());
   EXPECT_CALL(*m_controller, tap(id)).Times(1);
-  g_action_group_activate_action(action_group, "activate-transfer", g_variant_new_string(id));
+  g_action_group_activate_action(action_group, "activate-transfer", g_variant_new_string(id.str().c_str()));
   wait_msec();
 
   // try tapping a transfer that CAN'T be resumed
-  id = "c";
+  id = Transfer::Id("c");
   EXPECT_TRUE(!m_source->get_model()->get(id)->can_resume());
   EXPECT_CALL(*m_controller, tap(id)).Times(1);
-  g_action_group_activate_action(action_group, "activate-transfer", g_variant_new_string(id));
+  g_action_group_activate_action(action_group, "activate-transfer", g_variant_new_string(id.str().c_str()));
   wait_msec();
 
   // try cancelling a transfer
-  id = "a";
+  id = Transfer::Id("a");
   EXPECT_CALL(*m_controller, cancel(id)).Times(1);
-  g_action_group_activate_action(action_group, "cancel-transfer", g_variant_new_string(id));
+  g_action_group_activate_action(action_group, "cancel-transfer", g_variant_new_string(id.str().c_str()));
   wait_msec();
 
   // try opening a transfer
-  id = "b";
+  id = Transfer::Id("b");
   EXPECT_CALL(*m_controller, open(id)).Times(1);
-  g_action_group_activate_action(action_group, "open-transfer", g_variant_new_string(id));
+  g_action_group_activate_action(action_group, "open-transfer", g_variant_new_string(id.str().c_str()));
   wait_msec();
 
   // try opening a transfer's recipient's app
-  id = "c";
+  id = Transfer::Id("c");
   EXPECT_CALL(*m_controller, open_app(id)).Times(1);
-  g_action_group_activate_action(action_group, "open-app-transfer", g_variant_new_string(id));
+  g_action_group_activate_action(action_group, "open-app-transfer", g_variant_new_string(id.str().c_str()));
   wait_msec();
 
   // try calling clear-all
@@ -238,9 +238,9 @@ TEST_F(GMenuViewFixture, InvokedGActionsCallTheController)
   wait_msec();
 
   // try pausing a transfer
-  id = "a";
+  id = Transfer::Id("a");
   EXPECT_CALL(*m_controller, pause(id)).Times(1);
-  g_action_group_activate_action(action_group, "pause-transfer", g_variant_new_string(id));
+  g_action_group_activate_action(action_group, "pause-transfer", g_variant_new_string(id.str().c_str()));
   wait_msec();
 
   // try calling pause-all
@@ -254,9 +254,9 @@ TEST_F(GMenuViewFixture, InvokedGActionsCallTheController)
   wait_msec();
 
   // try resuming a transfer
-  id = "a";
+  id = Transfer::Id("a");
   EXPECT_CALL(*m_controller, resume(id)).Times(1);
-  g_action_group_activate_action(action_group, "resume-transfer", g_variant_new_string(id));
+  g_action_group_activate_action(action_group, "resume-transfer", g_variant_new_string(id.str().c_str()));
   wait_msec();
 
   // cleanup
@@ -361,7 +361,7 @@ TEST_F(GMenuViewFixture, PhoneHeader)
   // Visibility test #2:
   // Change the model to all transfers finished except one running.
   // Confirm that the header is visible.
-  auto transfer = m_source->get_model()->get("a");
+  auto transfer = m_source->get_model()->get(Transfer::Id("a"));
   transfer->state = Transfer::RUNNING;
   m_source->m_model->emit_changed(transfer->id);
   wait_msec(200);
@@ -370,7 +370,7 @@ TEST_F(GMenuViewFixture, PhoneHeader)
   // Visibility test #3:
   // Change the model to all transfers finished except one paused.
   // Confirm that the header is visible.
-  transfer = m_source->get_model()->get("a");
+  transfer = m_source->get_model()->get(Transfer::Id("a"));
   transfer->state = Transfer::PAUSED;
   m_source->m_model->emit_changed(transfer->id);
   wait_msec(200);